@@ -61,9 +61,8 @@ static int command_updatemetadata(client_t *client, source_t *source, int respon
 static int command_admin_function (client_t *client, int response);
 static int command_list_log (client_t *client, int response);
 static int command_manage_relay (client_t *client, int response);
-#ifdef MY_ALLOC
+static int command_workers (client_t *client, int response);
 static int command_alloc(client_t *client);
-#endif
 
 static int admin_handle_general_request(client_t *client, const char *command);
 
@@ -86,9 +85,8 @@ static struct admin_command admin_general[] =
     { "managerelays",       RAW,    { command_manage_relay } },
     { "listmounts",         RAW,    { command_list_mounts } },
     { "function",           RAW,    { command_admin_function } },
-#ifdef MY_ALLOC
+    { "workers",            RAW,    { command_workers } },
     { "alloc",              RAW,    { command_alloc } },
-#endif
     { "streamlist.txt",     TEXT,   { command_list_mounts } },
     { "streams",            TEXT,   { command_list_mounts } },
     { "showlog.txt",        TEXT,   { command_list_log } },
@@ -1217,16 +1215,124 @@ static int command_updatemetadata(client_t *client, source_t *source, int respon
 }
 
 
-#ifdef MY_ALLOC
+static void add_worker_histogram (xmlNodePtr parent, const char *name, const char *kind, worker_hist_t *hist)
+{
+    xmlNodePtr hnode = xmlNewChild (parent, NULL, XMLSTR("histogram"), NULL);
+    char value[25];
+    int i;
+
+    xmlSetProp (hnode, XMLSTR("name"), XMLSTR(name));
+    if (kind)
+        xmlSetProp (hnode, XMLSTR("kind"), XMLSTR(kind));
+    snprintf (value, sizeof value, "%" PRIu64, hist->count);
+    xmlSetProp (hnode, XMLSTR("count"), XMLSTR(value));
+    snprintf (value, sizeof value, "%" PRIu64, hist->sum);
+    xmlSetProp (hnode, XMLSTR("sum"), XMLSTR(value));
+    snprintf (value, sizeof value, "%" PRIu64, hist->recent_p99);
+    xmlSetProp (hnode, XMLSTR("recent_p99"), XMLSTR(value));
+    for (i = 0; i < WORKER_HIST_BUCKETS; i++)
+    {
+        xmlNodePtr bnode;
+
+        if (hist->bucket [i] == 0)
+            continue;
+        snprintf (value, sizeof value, "%" PRIu64, hist->bucket [i]);
+        bnode = xmlNewChild (hnode, NULL, XMLSTR("bucket"), XMLSTR(value));
+        if (i == WORKER_HIST_BUCKETS - 1)
+            snprintf (value, sizeof value, "%" PRIu64 "+", worker_hist_limit (i));
+        else
+            snprintf (value, sizeof value, "%" PRIu64, worker_hist_limit (i));
+        xmlSetProp (bnode, XMLSTR("max"), XMLSTR(value));
+    }
+}
+
+
+/* per worker timings, histograms are folded in once a second by each worker */
+static int command_workers (client_t *client, int response)
+{
+    static const char *kinds[CLIENT_OPS_KINDS] = { "other", "listener", "source", "fserve", "stats", "relay" };
+    xmlDocPtr doc = xmlNewDoc (XMLSTR("1.0"));
+    xmlNodePtr rootnode = xmlNewDocNode(doc, NULL, XMLSTR("icestats"), NULL);
+    worker_t *worker;
+    char value[25];
+
+    xmlDocSetRootElement(doc, rootnode);
+
+    thread_rwlock_rlock (&workers_lock);
+    for (worker = workers; worker; worker = worker->next)
+    {
+        xmlNodePtr wnode = xmlNewChild (rootnode, NULL, XMLSTR("worker"), NULL);
+        int i;
+
+        snprintf (value, sizeof value, "%p", worker);
+        xmlSetProp (wnode, XMLSTR("id"), XMLSTR(value));
+        snprintf (value, sizeof value, "%d", worker->count);
+        xmlNewChild (wnode, NULL, XMLSTR("clients"), XMLSTR(value));
+        snprintf (value, sizeof value, "%u.%u", worker->load / 10, worker->load % 10);
+        xmlNewChild (wnode, NULL, XMLSTR("load"), XMLSTR(value));
+        snprintf (value, sizeof value, "%d", worker->cpu);
+        xmlNewChild (wnode, NULL, XMLSTR("cpu"), XMLSTR(value));
+        snprintf (value, sizeof value, "%d", worker->node);
+        xmlNewChild (wnode, NULL, XMLSTR("node"), XMLSTR(value));
+        snprintf (value, sizeof value, "%u", worker->stalls);
+        xmlNewChild (wnode, NULL, XMLSTR("stalls"), XMLSTR(value));
+        if (worker->uring)
+        {
+            snprintf (value, sizeof value, "%" PRIu64, worker->batched_sends);
+            xmlNewChild (wnode, NULL, XMLSTR("batched_sends"), XMLSTR(value));
+            snprintf (value, sizeof value, "%" PRIu64, worker->batch_submits);
+            xmlNewChild (wnode, NULL, XMLSTR("batch_submits"), XMLSTR(value));
+        }
+        snprintf (value, sizeof value, "%" PRIu64, worker->gathered_sends);
+        xmlNewChild (wnode, NULL, XMLSTR("gathered_sends"), XMLSTR(value));
+        snprintf (value, sizeof value, "%" PRIu64, worker->sends_saved);
+        xmlNewChild (wnode, NULL, XMLSTR("sends_saved"), XMLSTR(value));
+        add_worker_histogram (wnode, "loop_us", NULL, &worker->loop_us);
+        add_worker_histogram (wnode, "pass_clients", NULL, &worker->pass_clients);
+        add_worker_histogram (wnode, "lag_ms", NULL, &worker->lag_ms);
+        for (i = 0; i < CLIENT_OPS_KINDS; i++)
+            add_worker_histogram (wnode, "process_us", kinds[i], &worker->process_us[i]);
+    }
+    thread_rwlock_unlock (&workers_lock);
+
+    return admin_send_response (doc, client, response, "stats.xsl");
+}
+
+
 static int command_alloc(client_t *client)
 {
     xmlDocPtr doc = xmlNewDoc (XMLSTR("1.0"));
     xmlNodePtr rootnode = xmlNewDocNode(doc, NULL, XMLSTR("icestats"), NULL);
-    avl_node *node;
+    refbuf_pool_stats_t pools [REFBUF_CLASSES];
     char value[25];
+    int i, count;
 
     xmlDocSetRootElement(doc, rootnode);
 
+    count = refbuf_pool_stats (pools, REFBUF_CLASSES);
+    for (i = 0; i < count; i++)
+    {
+        xmlNodePtr pnode = xmlNewChild (rootnode, NULL, XMLSTR("refbuf_pool"), NULL);
+
+        snprintf (value, sizeof value, "%u", pools[i].size);
+        xmlSetProp (pnode, XMLSTR("size"), XMLSTR(value));
+        snprintf (value, sizeof value, "%u", pools[i].allocated);
+        xmlNewChild (pnode, NULL, XMLSTR("allocated"), XMLSTR(value));
+        snprintf (value, sizeof value, "%u", pools[i].allocated - pools[i].cached - pools[i].spare);
+        xmlNewChild (pnode, NULL, XMLSTR("in_use"), XMLSTR(value));
+        snprintf (value, sizeof value, "%u", pools[i].cached);
+        xmlNewChild (pnode, NULL, XMLSTR("cached"), XMLSTR(value));
+        snprintf (value, sizeof value, "%u", pools[i].spare);
+        xmlNewChild (pnode, NULL, XMLSTR("spare"), XMLSTR(value));
+        snprintf (value, sizeof value, "%" PRIu64, pools[i].hits);
+        xmlNewChild (pnode, NULL, XMLSTR("hits"), XMLSTR(value));
+        snprintf (value, sizeof value, "%" PRIu64, pools[i].misses);
+        xmlNewChild (pnode, NULL, XMLSTR("misses"), XMLSTR(value));
+    }
+#ifdef MY_ALLOC
+    {
+    avl_node *node;
+
     snprintf (value, sizeof value, "%d", xmlMemUsed());
     xmlNewChild (rootnode, NULL, XMLSTR("libxml_mem"), XMLSTR(value));
 
@@ -1245,8 +1351,9 @@ static int command_alloc(client_t *client)
         node = avl_get_next (node);
     }
     avl_tree_unlock (global.alloc_tree);
+    }
+#endif
 
     return admin_send_response (doc, client, RAW, "stats.xsl");
 }
-#endif
 
@@ -351,7 +351,10 @@ static void *auth_run_thread (void *arg)
 {
     auth_thread_t *handler = arg;
     auth_t *auth = handler->auth;
+    ice_config_t *config = config_get_config ();
 
+    util_set_cpu_affinity (config->auth_cpus, -1);
+    config_release_config ();
     DEBUG2 ("Authentication thread %d started for %s", handler->id, auth->mount);
     thread_rwlock_rlock (&auth_lock);
 
@@ -373,6 +373,9 @@ void config_clear(ice_config_t *c)
     if (c->source_password) xmlFree(c->source_password);
     if (c->admin_username) xmlFree(c->admin_username);
     if (c->admin_password) xmlFree(c->admin_password);
+    if (c->worker_cpus) xmlFree(c->worker_cpus);
+    if (c->connection_cpus) xmlFree(c->connection_cpus);
+    if (c->auth_cpus) xmlFree(c->auth_cpus);
     if (c->relay_username) xmlFree(c->relay_username);
     if (c->relay_password) xmlFree(c->relay_password);
     if (c->hostname) xmlFree(c->hostname);
@@ -947,6 +950,7 @@ static int _parse_mount (xmlNodePtr node, void *arg)
         { "source-timeout",     config_get_int,     &mount->source_timeout },
         { "queue-size",         config_get_int,     &mount->queue_size_limit },
         { "burst-size",         config_get_int,     &mount->burst_size},
+        { "burst-duration",     config_get_int,     &mount->burst_duration},
         { "min-queue-size",     config_get_int,     &mount->min_queue_size},
         { "username",           config_get_str,     &mount->username },
         { "password",           config_get_str,     &mount->password },
@@ -978,6 +982,7 @@ static int _parse_mount (xmlNodePtr node, void *arg)
         { "no-mount",           config_get_bool,    &mount->no_mount },
         { "ban-client",         config_get_int,     &mount->ban_client },
         { "so-sndbuf",          config_get_int,     &mount->so_sndbuf },
+        { "kernel-pacing",      config_get_bool,    &mount->kernel_pacing },
         { "hidden",             config_get_bool,    &mount->hidden },
         { "authentication",     auth_get_authenticator, &mount->auth },
         { "on-connect",         config_get_str,     &mount->on_connect },
@@ -1206,6 +1211,13 @@ static int _parse_limits (xmlNodePtr node, void *arg)
         { "min-queue-size", config_get_int,    &config->min_queue_size },
         { "burst-size",     config_get_int,    &config->burst_size },
         { "workers",        config_get_int,    &config->workers_count },
+        { "workers-min",    config_get_int,    &config->workers_min },
+        { "workers-max",    config_get_int,    &config->workers_max },
+        { "worker-epoll",   config_get_bool,   &config->workers_epoll },
+        { "worker-uring",   config_get_bool,   &config->workers_uring },
+        { "worker-cpus",    config_get_str,    &config->worker_cpus },
+        { "connection-cpus", config_get_str,   &config->connection_cpus },
+        { "auth-cpus",      config_get_str,    &config->auth_cpus },
         { "client-timeout", config_get_int,    &config->client_timeout },
         { "header-timeout", config_get_int,    &config->header_timeout },
         { "source-timeout", config_get_int,    &config->source_timeout },
@@ -1216,6 +1228,8 @@ static int _parse_limits (xmlNodePtr node, void *arg)
         return -1;
     if (config->workers_count < 1)   config->workers_count = 1;
     if (config->workers_count > 400) config->workers_count = 400;
+    if (config->workers_min < 1)     config->workers_min = 1;
+    if (config->workers_max > 400)   config->workers_max = 400;
     return 0;
 }
 
@@ -1264,6 +1278,7 @@ static int _parse_listen_sock (xmlNodePtr node, void *arg)
         { "so-sndbuf",          config_get_int,     &listener->so_sndbuf },
 #ifndef _WIN32
         { "so-mss",             config_get_int,     &listener->so_mss },
+        { "so-zerocopy",        config_get_int,     &listener->so_zerocopy },
 #endif
         { "ssl",                config_get_bool,    &listener->ssl },
         { "shoutcast-mount",    config_get_str,     &listener->shoutcast_mount },
@@ -120,8 +120,10 @@ typedef struct _mount_proxy {
     int no_mount; /* Do we permit direct requests of this mountpoint? (or only
                      indirect, through fallbacks) */
     int so_sndbuf;      /* TCP send buffer size for new clients */
+    int kernel_pacing;  /* leave listener pacing to the kernel after the burst */
     int burst_size; /* amount to send to a new client if possible, -1 take
                      * from global setting */
+    int burst_duration; /* burst in ms instead, for streams with frame indexes */
     int min_queue_size;     /* minimum length of queue */
     unsigned int queue_size_limit;
     int hidden; /* Do we list this on the xsl pages */
@@ -194,6 +196,7 @@ struct _listener_t
     int ssl;
     int so_sndbuf;
     int so_mss;
+    int so_zerocopy;    /* minimum send size for MSG_ZEROCOPY, 0 for off */
 };
 
 
@@ -254,6 +257,12 @@ typedef struct ice_config_tag
     unsigned int queue_size_limit;
     int min_queue_size;
     int workers_count;
+    int workers_min, workers_max;   /* autoscaling bounds, off unless max > min */
+    int workers_epoll; /* use epoll readiness to trigger client processing */
+    int workers_uring; /* batch listener sends through io_uring */
+    char *worker_cpus;      /* cpu lists to place threads on */
+    char *connection_cpus;
+    char *auth_cpus;
     unsigned int burst_size;
     int client_timeout;
     int header_timeout;
@@ -25,7 +25,28 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#ifdef HAVE_LINUX_ERRQUEUE_H
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#ifndef IO_URING_OP_SUPPORTED
+#undef HAVE_LINUX_IO_URING_H    /* too old to probe for sendmsg support */
+#endif
+#endif
 
 #include "thread/thread.h"
 #include "avl/avl.h"
@@ -50,7 +71,29 @@
 #define CATMODULE "client"
 
 int worker_count, worker_min_count;
-worker_t *worker_balance_to_check, *worker_least_used;
+worker_t *worker_least_used;
+
+/* a thread keeps up to CLIENT_POOL_KEEP of each type and passes batches to
+ * the spare stacks, which threads take whole when their own pool runs dry */
+#define CLIENT_POOL_KEEP            128
+#define CLIENT_POOL_BATCH           64
+#define CLIENT_POOL_SPARE           2048
+
+/* most queue blocks gathered into one writev for a listener */
+#define CLIENT_GATHER_BLOCKS        16
+
+static pthread_key_t client_pools_key;
+static pthread_once_t client_pools_once = PTHREAD_ONCE_INIT;
+static mutex_t client_pools_lock;
+static client_pools_t *client_pools_list;
+static void *client_pool_spare [CLIENT_POOL_TYPES];
+static int client_pool_spare_count [CLIENT_POOL_TYPES];
+static char *client_pool_names [CLIENT_POOL_TYPES] = { "pool_clients", "pool_parsers" };
+
+/* advanced when shared data is unlinked, see worker_epoch_retire */
+static uint64_t worker_epoch = 1;
+
+static void client_zerocopy_release (client_t *client);
 
 
 void client_register (client_t *client)
@@ -60,6 +103,250 @@ void client_register (client_t *client)
 }
 
 
+static void client_pools_init (void)
+{
+    pthread_key_create (&client_pools_key, NULL);
+    thread_mutex_create (&client_pools_lock);
+}
+
+
+// make the pools used by the calling thread, worker or connection thread,
+// buffers are cached by the refbuf pools
+void client_pools_attach (client_pools_t *pools)
+{
+    pthread_once (&client_pools_once, client_pools_init);
+    thread_mutex_lock (&client_pools_lock);
+    pools->next = client_pools_list;
+    atomic_store_release (&client_pools_list, pools); // walked unlocked for epochs
+    thread_mutex_unlock (&client_pools_lock);
+    pthread_setspecific (client_pools_key, pools);
+    refbuf_cache_attach (&pools->refbufs);
+}
+
+
+void client_pools_detach (client_pools_t *pools)
+{
+    client_pools_t **p;
+    uint64_t epoch;
+    int type;
+
+    refbuf_cache_detach (&pools->refbufs);
+    pthread_setspecific (client_pools_key, NULL);
+    thread_mutex_lock (&client_pools_lock);
+    for (p = &client_pools_list; *p; p = &(*p)->next)
+        if (*p == pools)
+        {
+            // left intact, an unlocked epoch check may still be on it
+            atomic_store_release (p, pools->next);
+            break;
+        }
+    thread_mutex_unlock (&client_pools_lock);
+    // the caller may release the pools once no unlocked walk can be on them
+    epoch = worker_epoch_retire ();
+    while (worker_epoch_passed (epoch) == 0)
+        thread_sleep (1000);
+    for (type = 0; type < CLIENT_POOL_TYPES; type++)
+    {
+        while (pools->free [type])
+        {
+            void *item = pools->free [type];
+
+            pools->free [type] = *(void**)item;
+            free (item);
+        }
+        pools->count [type] = 0;
+    }
+}
+
+
+static client_pools_t *client_pools_current (void)
+{
+    pthread_once (&client_pools_once, client_pools_init);
+    return pthread_getspecific (client_pools_key);
+}
+
+
+static void client_pool_push_spare (int type, void *first, void *last, int count)
+{
+    void *head;
+
+    do
+    {
+        head = client_pool_spare [type];
+        *(void**)last = head;
+    } while (atomic_cas (&client_pool_spare [type], head, first) == 0);
+    atomic_add (&client_pool_spare_count [type], count);
+}
+
+
+static void *client_pool_get (int type)
+{
+    client_pools_t *pools = client_pools_current ();
+    void *item;
+
+    if (pools == NULL)
+        return NULL;
+    if (pools->free [type] == NULL && client_pool_spare [type])
+    {
+        // the whole stack is taken so no other thread can be popping these
+        void *chain = atomic_swap (&client_pool_spare [type], NULL);
+        int count = 0;
+
+        for (item = chain; item; item = *(void**)item)
+            count++;
+        atomic_sub (&client_pool_spare_count [type], count);
+        pools->free [type] = chain;
+        pools->count [type] = count;
+    }
+    item = pools->free [type];
+    if (item == NULL)
+    {
+        pools->misses [type]++;
+        return NULL;
+    }
+    pools->free [type] = *(void**)item;
+    pools->count [type]--;
+    pools->hits [type]++;
+    return item;
+}
+
+
+static void client_pool_put (int type, void *item)
+{
+    client_pools_t *pools = client_pools_current ();
+    void *last;
+    int count;
+
+    if (pools == NULL)
+    {
+        // threads without pools hand single items straight to the spares
+        if (client_pool_spare_count [type] >= CLIENT_POOL_SPARE)
+            free (item);
+        else
+            client_pool_push_spare (type, item, item, 1);
+        return;
+    }
+    *(void**)item = pools->free [type];
+    pools->free [type] = item;
+    if (++pools->count [type] <= CLIENT_POOL_KEEP)
+        return;
+    // keep the recently freed, pass the older ones on
+    last = pools->free [type];
+    for (count = 1; count < CLIENT_POOL_KEEP - CLIENT_POOL_BATCH; count++)
+        last = *(void**)last;
+    item = *(void**)last;
+    *(void**)last = NULL;
+    count = pools->count [type] - count;
+    pools->count [type] -= count;
+    if (client_pool_spare_count [type] < CLIENT_POOL_SPARE)
+    {
+        for (last = item; *(void**)last; last = *(void**)last)
+            ;
+        client_pool_push_spare (type, item, last, count);
+        return;
+    }
+    while (item)
+    {
+        void *next = *(void**)item;
+        free (item);
+        item = next;
+    }
+}
+
+
+client_t *client_pool_client (void)
+{
+    client_t *client = client_pool_get (CLIENT_POOL_CLIENT);
+
+    if (client == NULL)
+        return calloc (1, sizeof (client_t));
+    memset (client, 0, sizeof (client_t));
+    return client;
+}
+
+
+void client_pool_free_client (client_t *client)
+{
+    if (client)
+        client_pool_put (CLIENT_POOL_CLIENT, client);
+}
+
+
+http_parser_t *client_pool_parser (void)
+{
+    http_parser_t *parser = client_pool_get (CLIENT_POOL_PARSER);
+
+    if (parser == NULL)
+        return httpp_create_parser();
+    return parser;
+}
+
+
+void client_pool_free_parser (http_parser_t *parser)
+{
+    if (parser == NULL)
+        return;
+    httpp_clear (parser);
+    client_pool_put (CLIENT_POOL_PARSER, parser);
+}
+
+
+/* Readers of shared data, like listeners walking a source queue, may do so
+ * without a lock while within a worker pass. Data unlinked by a writer is
+ * stamped with the epoch returned here and can be freed once every worker
+ * has started a later pass or is idle.
+ */
+uint64_t worker_epoch_retire (void)
+{
+    atomic_barrier();
+    return atomic_add (&worker_epoch, 1) - 1;
+}
+
+
+/* called within a worker pass or by the thread freeing detached pools, so
+ * the list can be walked without the lock, a detached entry is not freed
+ * until after an epoch has passed */
+int worker_epoch_passed (uint64_t epoch)
+{
+    client_pools_t *pools;
+
+    for (pools = atomic_load_acquire (&client_pools_list); pools;
+            pools = atomic_load_acquire (&pools->next))
+    {
+        uint64_t seen = atomic_load_acquire (&pools->epoch);
+        if (seen && seen <= epoch)
+            return 0;
+    }
+    return 1;
+}
+
+
+// hit rate of the pools since startup, reported with the worker stats
+static void client_pools_stats (void)
+{
+    uint64_t hits [CLIENT_POOL_TYPES] = { 0 }, misses [CLIENT_POOL_TYPES] = { 0 };
+    client_pools_t *pools;
+    int type;
+
+    pthread_once (&client_pools_once, client_pools_init);
+    thread_mutex_lock (&client_pools_lock);
+    for (pools = client_pools_list; pools; pools = pools->next)
+        for (type = 0; type < CLIENT_POOL_TYPES; type++)
+        {
+            hits [type] += pools->hits [type];
+            misses [type] += pools->misses [type];
+        }
+    thread_mutex_unlock (&client_pools_lock);
+    for (type = 0; type < CLIENT_POOL_TYPES; type++)
+    {
+        uint64_t total = hits [type] + misses [type];
+
+        stats_event_args (NULL, client_pool_names [type], "%d%% of %" PRIu64 " (%d spare)",
+                total ? (int)(hits [type] * 100 / total) : 0, total, client_pool_spare_count [type]);
+    }
+}
+
+
 const char *client_keepalive_header (client_t *client)
 {
     return (client->flags & CLIENT_KEEPALIVE) ?  "Connection: Keep-Alive" : "Connection: Close";
@@ -114,7 +401,7 @@ void client_destroy(client_t *client)
     }
 
     if (client->parser)
-        httpp_destroy (client->parser);
+        client_pool_free_parser (client->parser);
 
     /* we need to free client specific format data (if any) */
     if (client->free_client_data)
@@ -137,9 +424,10 @@ void client_destroy(client_t *client)
         global.clients--;
         config_clear_listener (client->server_conn);
         global_unlock ();
+        client_zerocopy_release (client);
         connection_close (&client->connection);
 
-        free(client);
+        client_pool_free_client (client);
         return;
     }
     global_unlock ();
@@ -360,6 +648,173 @@ int client_send_options(client_t *client)
 }
 
 
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+/* zero copy sends leave the data in place until transmitted, so the blocks
+ * sent are referenced until the socket error queue reports them done. Each
+ * successful send gets the next sequence number, completions come as ranges.
+ */
+#define CLIENT_ZEROCOPY_PINS    64
+#define CLIENT_ZEROCOPY_BLOCKS  8
+
+struct _client_zerocopy
+{
+    uint32_t seq;       /* given to the next send */
+    unsigned int head, count;
+    int disabled;       /* not supported or the kernel copies anyway */
+    struct {
+        refbuf_t *refbuf;
+        uint32_t seq;
+    } pins [CLIENT_ZEROCOPY_PINS];
+};
+
+
+static void client_zerocopy_reap (client_t *client)
+{
+    struct _client_zerocopy *zc = client->zerocopy;
+
+    while (zc && zc->count)
+    {
+        char control [128];
+        struct msghdr msg;
+        struct cmsghdr *cm;
+
+        memset (&msg, 0, sizeof (msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof (control);
+        if (recvmsg (client->connection.sock, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) < 0)
+            break;
+        for (cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm))
+        {
+            struct sock_extended_err *err = (struct sock_extended_err *)CMSG_DATA (cm);
+
+            if ((cm->cmsg_level != IPPROTO_IP || cm->cmsg_type != IP_RECVERR) &&
+                    (cm->cmsg_level != IPPROTO_IPV6 || cm->cmsg_type != IPV6_RECVERR))
+                continue;
+            if (err->ee_errno || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                zc->disabled = 1;
+            while (zc->count && (int32_t)(zc->pins [zc->head].seq - err->ee_data) <= 0)
+            {
+                refbuf_release (zc->pins [zc->head].refbuf);
+                zc->head = (zc->head + 1) % CLIENT_ZEROCOPY_PINS;
+                zc->count--;
+            }
+        }
+    }
+}
+
+
+static void client_zerocopy_release (client_t *client)
+{
+    struct _client_zerocopy *zc = client->zerocopy;
+
+    if (zc == NULL)
+        return;
+    client_zerocopy_reap (client);
+    while (zc->count)
+    {
+        refbuf_release (zc->pins [zc->head].refbuf);
+        zc->head = (zc->head + 1) % CLIENT_ZEROCOPY_PINS;
+        zc->count--;
+    }
+    free (zc);
+    client->zerocopy = NULL;
+}
+
+
+/* send the blocks from refbuf at pos, up to limit bytes, without copying them
+ * to the socket, if enough to be worth it. Returns the bytes sent, -1 on a
+ * failed send or -2 if a normal send should be made instead. The client is
+ * rescheduled later on a short or failed send
+ */
+int client_send_pinned (client_t *client, refbuf_t *refbuf, unsigned int pos, unsigned int limit)
+{
+    struct _client_zerocopy *zc = client->zerocopy;
+    unsigned int threshold = client_zerocopy_size (client), total = 0, count = 0, i;
+    refbuf_t *blocks [CLIENT_ZEROCOPY_BLOCKS];
+    struct iovec iov [CLIENT_ZEROCOPY_BLOCKS];
+    struct msghdr msg;
+    int ret;
+
+    // completions are collected once a few sends are outstanding
+    if (zc && zc->count >= (zc->disabled ? 1 : CLIENT_ZEROCOPY_PINS/4))
+        client_zerocopy_reap (client);
+    if (threshold == 0 || limit < (unsigned int)threshold || (zc && zc->disabled))
+        return -2;
+#ifdef HAVE_OPENSSL
+    if (client->connection.ssl)
+        return -2;
+#endif
+    for (; refbuf && count < CLIENT_ZEROCOPY_BLOCKS && total < limit; refbuf = refbuf->next, pos = 0)
+    {
+        unsigned int len = refbuf->len - pos;
+
+        if (len > limit - total)
+            len = limit - total;
+        iov [count].iov_base = refbuf->data + pos;
+        iov [count].iov_len = len;
+        blocks [count++] = refbuf;
+        total += len;
+    }
+    if (total < (unsigned int)threshold)
+        return -2;
+    if (zc == NULL)
+    {
+        int on = 1;
+
+        zc = client->zerocopy = calloc (1, sizeof (*zc));
+        if (setsockopt (client->connection.sock, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof (on)) < 0)
+        {
+            zc->disabled = 1;
+            return -2;
+        }
+    }
+    if (zc->count + count > CLIENT_ZEROCOPY_PINS)
+        return -2;
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ret = sendmsg (client->connection.sock, &msg, MSG_ZEROCOPY|MSG_DONTWAIT|MSG_NOSIGNAL);
+    if (ret < 0 && errno == ENOBUFS)
+        return -2;  // past the locked memory allowance, copy instead
+    if (ret < (int)total)
+        client_send_backoff (client, ret);
+    if (ret < 0)
+    {
+        if (! sock_recoverable (sock_error()))
+            client->connection.error = 1;
+        return -1;
+    }
+    client->connection.sent_bytes += ret;
+    for (i = 0, total = 0; i < count && total < (unsigned int)ret; total += iov[i].iov_len, i++)
+    {
+        unsigned int slot = (zc->head + zc->count) % CLIENT_ZEROCOPY_PINS;
+
+        refbuf_addref (blocks [i]);
+        zc->pins [slot].refbuf = blocks [i];
+        zc->pins [slot].seq = zc->seq;
+        zc->count++;
+    }
+    if (ret > 0)
+    {
+        zc->seq++;
+        client_gathered_send (client, count);
+    }
+    return ret;
+}
+#else
+static void client_zerocopy_release (client_t *client)
+{
+}
+
+int client_send_pinned (client_t *client, refbuf_t *refbuf, unsigned int pos, unsigned int limit)
+{
+    return -2;
+}
+#endif
+
+
 /* helper function for sending the data to a client */
 int client_send_bytes (client_t *client, const void *buf, unsigned len)
 {
@@ -378,6 +833,59 @@ int client_send_bytes (client_t *client, const void *buf, unsigned len)
 }
 
 
+/* send the blocks from refbuf at pos, up to limit bytes, with one writev.
+ * Returns the bytes sent or -1 on a failed send, the client is rescheduled
+ * later if not all were taken.
+ */
+int client_send_blocks (client_t *client, refbuf_t *refbuf, unsigned int pos, unsigned int limit)
+{
+    struct connection_bufs bufs;
+    unsigned int total = 0;
+    int ret, count = 0;
+
+    connection_bufs_init (&bufs, CLIENT_GATHER_BLOCKS);
+    for (; refbuf && count < CLIENT_GATHER_BLOCKS && total < limit; refbuf = refbuf->next, pos = 0)
+    {
+        unsigned int len = refbuf->len - pos;
+
+        if (len > limit - total)
+            len = limit - total;
+        connection_bufs_append (&bufs, refbuf->data + pos, len);
+        total += len;
+        count++;
+    }
+    ret = connection_bufs_send (&client->connection, &bufs, 0);
+    connection_bufs_release (&bufs);
+    if (ret < (int)total)
+        client_send_backoff (client, ret);
+    if (ret > 0)
+        client_gathered_send (client, count);
+    return ret;
+}
+
+
+/* reschedule the client after a short send, or for longer after a failed one */
+void client_send_backoff (client_t *client, int ret)
+{
+    client->schedule_ms += 10 + client->throttle * (ret < 0 ? 15 : 6);
+}
+
+
+/* account for a send that covered several queue blocks, in place of a send
+ * for each of them
+ */
+void client_gathered_send (client_t *client, unsigned int blocks)
+{
+    worker_t *worker = client->worker;
+
+    if (worker && blocks > 1)
+    {
+        worker->gathered_sends++;
+        worker->sends_saved += blocks - 1;
+    }
+}
+
+
 static int client_send_buffer (client_t *client)
 {
     const char *buf = client->refbuf->data + client->pos;
@@ -435,6 +943,9 @@ void client_set_queue (client_t *client, refbuf_t *refbuf)
 }
 
 
+/* workers whose load is within the same band are compared on client count */
+#define WORKER_LOAD_BAND        25
+
 static worker_t *find_least_busy_handler (int log)
 {
     worker_t *min = workers;
@@ -442,16 +953,20 @@ static worker_t *find_least_busy_handler (int log)
     if (workers && workers->next)
     {
         worker_t *handler = workers->next;
+        unsigned int min_band = min->load / WORKER_LOAD_BAND;
 
         worker_min_count = min->count + min->pending_count;
-        if (log) DEBUG2 ("handler %p has %d clients", min, worker_min_count);
+        if (log) DEBUG3 ("handler %p has %d clients, load %u", min, worker_min_count, min->load);
         while (handler)
         {
             int cur_count = handler->count + handler->pending_count;
-            if (log) DEBUG2 ("handler %p has %d clients", handler, cur_count);
-            if (cur_count < worker_min_count)
+            unsigned int band = handler->load / WORKER_LOAD_BAND;
+
+            if (log) DEBUG3 ("handler %p has %d clients, load %u", handler, cur_count, handler->load);
+            if (band < min_band || (band == min_band && cur_count < worker_min_count))
             {
                 min = handler;
+                min_band = band;
                 worker_min_count = cur_count;
             }
             handler = handler->next;
@@ -469,14 +984,166 @@ worker_t *worker_selected (void)
 }
 
 
-/* worker mutex should be already locked */
+/* Balancing is driven by idle workers. Once a second each worker works out how
+ * busy it has been and, if mostly idle, asks the busiest worker for some clients.
+ * Only the owning worker can detach a client, so the request is picked up by the
+ * change worker checks made as clients are processed, which also keep listeners
+ * with their source. A request expires when the busy worker next updates its load.
+ * workers_lock should be held by the caller, weight is how many clients would move
+ * with this one, eg a source and its listeners.
+ */
+worker_t *worker_steal_dest (worker_t *worker, int weight)
+{
+    worker_t *dest = worker->steal_to;
+
+    if (dest == NULL || dest->running == 0 || worker->steal_count < weight)
+        return NULL;
+    worker->steal_count -= weight;
+    return dest;
+}
+
+
+static void worker_steal_request (worker_t *worker)
+{
+    worker_t *victim = NULL, *handler;
+    unsigned int victim_load = 0;
+
+    thread_rwlock_rlock (&workers_lock);
+    for (handler = workers; handler; handler = handler->next)
+    {
+        unsigned int load = handler->load;
+
+        if (handler == worker || handler->running == 0)
+            continue;
+        // prefer taking from the same node, elsewhere only if a lot busier
+        if (worker->node >= 0 && handler->node != worker->node)
+            load = load > WORKER_LOAD_MARGIN ? load - WORKER_LOAD_MARGIN : 0;
+        if (load > worker->load + WORKER_LOAD_MARGIN && (victim == NULL || load > victim_load))
+        {
+            victim = handler;
+            victim_load = load;
+        }
+    }
+    if (worker->running && victim && atomic_cas (&victim->steal_to, NULL, worker))
+    {
+        int batch = victim->count * (victim->load - worker->load) / (2 * victim->load);
+
+        if (batch > 200) batch = 200;
+        if (batch < 1) batch = 1;
+        victim->steal_count = batch;
+        DEBUG4 ("worker %p (load %u) to take up to %d clients from %p", worker, worker->load, batch, victim);
+    }
+    thread_rwlock_unlock (&workers_lock);
+}
+
+
+static void worker_hist_add (worker_hist_t *hist, uint64_t value)
+{
+    int bucket = 0;
+
+    if (value)
+    {
+        bucket = 64 - bit_clz64 (value);
+        if (bucket >= WORKER_HIST_BUCKETS)
+            bucket = WORKER_HIST_BUCKETS - 1;
+    }
+    hist->recent [bucket]++;
+    hist->recent_sum += value;
+}
+
+
+/* upper value of a bucket, the last has no limit so just report its lower one */
+uint64_t worker_hist_limit (int bucket)
+{
+    if (bucket >= WORKER_HIST_BUCKETS - 1)
+        return (uint64_t)1 << (WORKER_HIST_BUCKETS - 2);
+    return ((uint64_t)1 << bucket) - 1;
+}
+
+
+static void worker_hist_fold (worker_hist_t *hist)
+{
+    uint64_t count = 0, seen = 0;
+    int i;
+
+    for (i = 0; i < WORKER_HIST_BUCKETS; i++)
+        count += hist->recent [i];
+    if (count == 0)
+    {
+        hist->recent_p99 = 0;
+        return;
+    }
+    for (i = 0; i < WORKER_HIST_BUCKETS; i++)
+    {
+        seen += hist->recent [i];
+        if (seen * 100 >= count * 99)
+            break;
+    }
+    hist->recent_p99 = worker_hist_limit (i);
+    for (i = 0; i < WORKER_HIST_BUCKETS; i++)
+    {
+        hist->bucket [i] += hist->recent [i];
+        hist->recent [i] = 0;
+    }
+    hist->count += count;
+    hist->sum += hist->recent_sum;
+    hist->recent_sum = 0;
+}
+
+
+static int64_t worker_time_diff (struct timespec *start, struct timespec *end)
+{
+    return (int64_t)(end->tv_sec - start->tv_sec) * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+static void worker_load_update (worker_t *worker)
+{
+    uint64_t elapsed = worker->time_ms - worker->load_ms + 1000;
+    unsigned int load = elapsed ? (unsigned int)(worker->busy_us / elapsed) : 0;
+    int i;
+
+    worker_hist_fold (&worker->loop_us);
+    worker_hist_fold (&worker->pass_clients);
+    worker_hist_fold (&worker->lag_ms);
+    for (i = 0; i < CLIENT_OPS_KINDS; i++)
+        worker_hist_fold (&worker->process_us [i]);
+
+    if (load > 1000)
+        load = 1000;
+    worker->load = (worker->load + load) / 2;
+    worker->busy_us = 0;
+    worker->load_ms = worker->time_ms + 1000;
+    worker->move_allocations = 50;  // allowed moves, eg listeners joining their source
+    worker->steal_count = 0;
+    worker->steal_to = NULL;
+    if (worker->load < WORKER_LOAD_IDLE && worker_count > 1)
+        worker_steal_request (worker);
+}
+
+
+/* Clients handed to a worker are pushed onto its pending stack by any thread,
+ * only the worker itself takes them off, and always the whole stack at once,
+ * so a compare and swap on the head is enough. The count is raised before the
+ * push so it never drops below the number of clients visible on the stack.
+ */
+static void worker_push_pending (worker_t *worker, client_t *first, client_t *last, int count)
+{
+    client_t *head;
+
+    atomic_add (&worker->pending_count, count);
+    do
+    {
+        head = worker->pending_clients;
+        last->next_on_worker = head;
+    } while (atomic_cas (&worker->pending_clients, head, first) == 0);
+}
+
+
 static void worker_add_client (worker_t *worker, client_t *client)
 {
-    ++worker->pending_count;
-    client->next_on_worker = NULL;
-    *worker->pending_clients_tail = client;
-    worker->pending_clients_tail = &client->next_on_worker;
     client->worker = worker;
+    worker_push_pending (worker, client, client, 1);
 }
 
 
@@ -484,11 +1151,11 @@ int client_change_worker (client_t *client, worker_t *dest_worker)
 {
     if (dest_worker->running == 0)
         return 0;
-    client->next_on_worker = NULL;
+    client_wait_cancel (client);
+    if (client->woken)
+        return 0;   // still on the woken stack here, try later
 
-    thread_spin_lock (&dest_worker->lock);
     worker_add_client (dest_worker, client);
-    thread_spin_unlock (&dest_worker->lock);
     worker_wakeup (dest_worker);
 
     return 1;
@@ -502,19 +1169,247 @@ void client_add_worker (client_t *client)
     thread_rwlock_rlock (&workers_lock);
     /* add client to the handler with the least number of clients */
     handler = worker_selected();
-    thread_spin_lock (&handler->lock);
-    thread_rwlock_unlock (&workers_lock);
-
     worker_add_client (handler, client);
-    thread_spin_unlock (&handler->lock);
     worker_wakeup (handler);
+    thread_rwlock_unlock (&workers_lock);
 }
 
 
-#ifdef _WIN32
-#define pipe_create         sock_create_pipe_emulation
-#define pipe_write(A, B, C) send(A, B, C, 0)
-#define pipe_read(A,B,C)    recv(A, B, C, 0)
+/* Clients on a worker are held in a 4-ary heap ordered on worker_ms, which is
+ * the schedule_ms seen when the client was last placed. Only the worker thread
+ * touches the heap, clients woken through their waiters are brought forward as
+ * the worker takes them and any other schedule brought forward by another
+ * thread is picked up by a rescan.
+ */
+#define WORKER_SCAN_INTERVAL    200
+
+static void worker_heap_set (worker_t *worker, unsigned int slot, client_t *client)
+{
+    worker->heap [slot] = client;
+    client->worker_slot = slot;
+}
+
+
+static void worker_heap_up (worker_t *worker, unsigned int slot)
+{
+    client_t *client = worker->heap [slot];
+
+    while (slot)
+    {
+        unsigned int parent = (slot - 1) >> 2;
+
+        if (worker->heap [parent]->worker_ms <= client->worker_ms)
+            break;
+        worker_heap_set (worker, slot, worker->heap [parent]);
+        slot = parent;
+    }
+    worker_heap_set (worker, slot, client);
+}
+
+
+static void worker_heap_down (worker_t *worker, unsigned int slot)
+{
+    client_t *client = worker->heap [slot];
+
+    while (1)
+    {
+        unsigned int i = (slot << 2) + 1, min = i, last = i + 4;
+
+        if (i >= (unsigned int)worker->count)
+            break;
+        if (last > (unsigned int)worker->count)
+            last = worker->count;
+        for (i++; i < last; i++)
+            if (worker->heap [i]->worker_ms < worker->heap [min]->worker_ms)
+                min = i;
+        if (worker->heap [min]->worker_ms >= client->worker_ms)
+            break;
+        worker_heap_set (worker, slot, worker->heap [min]);
+        slot = min;
+    }
+    worker_heap_set (worker, slot, client);
+}
+
+
+/* place client using the already set worker_ms */
+static void worker_heap_add (worker_t *worker, client_t *client)
+{
+    if ((unsigned int)worker->count == worker->heap_size)
+    {
+        unsigned int len = worker->heap_size ? worker->heap_size * 2 : 64;
+        client_t **heap = realloc (worker->heap, len * sizeof (client_t*));
+
+        if (heap == NULL)
+        {
+            ERROR0 ("unable to grow worker client heap");
+            abort();
+        }
+        worker->heap = heap;
+        worker->heap_size = len;
+    }
+    worker_heap_set (worker, worker->count, client);
+    worker->count++;
+    worker_heap_up (worker, client->worker_slot);
+}
+
+
+static void worker_heap_remove (worker_t *worker, unsigned int slot)
+{
+    worker->count--;
+    if (slot < (unsigned int)worker->count)
+    {
+        client_t *last = worker->heap [worker->count];
+
+        worker_heap_set (worker, slot, last);
+        worker_heap_down (worker, slot);
+        worker_heap_up (worker, last->worker_slot);
+    }
+}
+
+
+/* reorder client for an updated schedule_ms */
+static void worker_heap_update (worker_t *worker, client_t *client)
+{
+    uint64_t prev = client->worker_ms;
+
+    client->worker_ms = client->schedule_ms;
+    if (client->worker_ms < prev)
+        worker_heap_up (worker, client->worker_slot);
+    else if (client->worker_ms > prev)
+        worker_heap_down (worker, client->worker_slot);
+}
+
+
+/* pick up active clients whose schedule was brought forward by another thread */
+static void worker_heap_rescan (worker_t *worker)
+{
+    unsigned int i;
+
+    for (i = 0; i < (unsigned int)worker->count; i++)
+    {
+        client_t *client = worker->heap [i];
+
+        if ((client->flags & CLIENT_ACTIVE) && client->schedule_ms < client->worker_ms)
+            worker_heap_update (worker, client);
+    }
+    worker->scan_ms = worker->time_ms + WORKER_SCAN_INTERVAL;
+}
+
+
+/* Clients expecting an event, eg listeners caught up with their source, are
+ * linked on the waiters for it rather than being polled. When it happens they
+ * are pushed onto the woken stack of their worker, which brings them forward
+ * in its heap at the start of the next pass. Pushes are only made under the
+ * waiters lock, so a client taken off the list, and off the woken stack if it
+ * was pushed, is no longer referred to and can leave its worker.
+ */
+void client_waiters_init (client_waiters_t *waiters)
+{
+    thread_spin_create (&waiters->lock);
+    waiters->first = NULL;
+}
+
+
+void client_waiters_destroy (client_waiters_t *waiters)
+{
+    thread_spin_destroy (&waiters->lock);
+}
+
+
+void client_wait_on (client_t *client, client_waiters_t *waiters)
+{
+    if (atomic_load_acquire (&client->waiting_on) == waiters)
+        return;
+    client_wait_cancel (client);
+    thread_spin_lock (&waiters->lock);
+    client->wait_next = waiters->first;
+    if (client->wait_next)
+        client->wait_next->wait_prev = &client->wait_next;
+    client->wait_prev = &waiters->first;
+    waiters->first = client;
+    client->waiting_on = waiters;
+    thread_spin_unlock (&waiters->lock);
+}
+
+
+void client_wait_cancel (client_t *client)
+{
+    client_waiters_t *waiters = atomic_load_acquire (&client->waiting_on);
+
+    if (waiters == NULL)
+        return;
+    thread_spin_lock (&waiters->lock);
+    if (client->waiting_on == waiters)  // may of just been woken
+    {
+        *client->wait_prev = client->wait_next;
+        if (client->wait_next)
+            client->wait_next->wait_prev = client->wait_prev;
+        client->waiting_on = NULL;
+    }
+    thread_spin_unlock (&waiters->lock);
+}
+
+
+void client_waiters_wake (client_waiters_t *waiters)
+{
+    client_t *client;
+    worker_t *last = NULL;
+
+    if (atomic_load_acquire (&waiters->first) == NULL)
+        return;
+    thread_spin_lock (&waiters->lock);
+    client = waiters->first;
+    waiters->first = NULL;
+    while (client)
+    {
+        client_t *next = client->wait_next;
+        worker_t *worker = client->worker;
+
+        atomic_store_release (&client->waiting_on, NULL);
+        if (atomic_swap (&client->woken, 1) == 0)   // not already on the stack
+        {
+            client_t *head;
+            do
+            {
+                head = worker->woken;
+                client->next_woken = head;
+            } while (atomic_cas (&worker->woken, head, client) == 0);
+            if (worker != last)
+                worker_wakeup (worker);
+            last = worker;
+        }
+        client = next;
+    }
+    thread_spin_unlock (&waiters->lock);
+}
+
+
+/* take the woken stack, clients no longer in the heap are already due */
+static void worker_woken_check (worker_t *worker)
+{
+    client_t *client = atomic_swap (&worker->woken, NULL);
+
+    while (client)
+    {
+        client_t *next = client->next_woken;
+        unsigned int slot = client->worker_slot;
+
+        atomic_store_release (&client->woken, 0);
+        if (slot < (unsigned int)worker->count && worker->heap [slot] == client &&
+                client->worker_ms > worker->time_ms)
+        {
+            client->schedule_ms = worker->time_ms;
+            worker_heap_update (worker, client);
+        }
+        client = next;
+    }
+}
+
+
+#ifdef _WIN32
+#define pipe_create         sock_create_pipe_emulation
+#define pipe_write(A, B, C) send(A, B, C, 0)
+#define pipe_read(A,B,C)    recv(A, B, C, 0)
 #else
  #ifdef HAVE_PIPE2
  #define pipe_create(x)      pipe2(x,O_CLOEXEC)
@@ -531,45 +1426,476 @@ void client_add_worker (client_t *client)
 #endif
 
 
+#ifdef HAVE_SYS_EPOLL_H
+/* epoll is used as a hint only, a client socket becoming readable (or hung up)
+ * makes the client due for processing. Timers still drive everything else so
+ * a missed event just means the client is handled at its scheduled time.
+ * Events are keyed on the socket and looked up, so a stale registration left
+ * behind by an inherited descriptor can never reference a released client.
+ */
+static void worker_poll_create (worker_t *worker)
+{
+    worker->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (worker->epoll_fd < 0)
+        WARN1 ("epoll unavailable (%s), using timed scans only", strerror (errno));
+}
+
+
+static void worker_poll_destroy (worker_t *worker)
+{
+    if (worker->epoll_fd >= 0)
+        close (worker->epoll_fd);
+    worker->epoll_fd = -1;
+    free (worker->poll_map);
+    worker->poll_map = NULL;
+    worker->poll_map_len = 0;
+}
+
+
+static void worker_poll_add (worker_t *worker, client_t *client)
+{
+    struct epoll_event ev;
+    sock_t sock = client->connection.sock;
+
+    if (worker->epoll_fd < 0)
+        return;
+    if (client->worker_sock != SOCK_ERROR && client->worker_sock < worker->poll_map_len &&
+            worker->poll_map [client->worker_sock] == client)
+        worker->poll_map [client->worker_sock] = NULL;
+    client->worker_sock = SOCK_ERROR;
+    if (sock == SOCK_ERROR)
+        return;
+    if (sock >= worker->poll_map_len)
+    {
+        unsigned int len = (sock + 1024) & ~1023;
+        client_t **map = realloc (worker->poll_map, len * sizeof (client_t*));
+
+        if (map == NULL)
+            return;
+        memset (map + worker->poll_map_len, 0, (len - worker->poll_map_len) * sizeof (client_t*));
+        worker->poll_map = map;
+        worker->poll_map_len = len;
+    }
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = sock;
+    if (epoll_ctl (worker->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0)
+    {
+        if (errno != EEXIST || epoll_ctl (worker->epoll_fd, EPOLL_CTL_MOD, sock, &ev) < 0)
+            return;
+    }
+    worker->poll_map [sock] = client;
+    client->worker_sock = sock;
+}
+
+
+/* client is leaving this worker, sock is what was registered for it */
+static void worker_poll_remove (worker_t *worker, client_t *client, sock_t sock)
+{
+    struct epoll_event ev;
+
+    if (worker->epoll_fd < 0 || sock == SOCK_ERROR)
+        return;
+    if (sock < worker->poll_map_len && worker->poll_map [sock] == client)
+        worker->poll_map [sock] = NULL;
+    epoll_ctl (worker->epoll_fd, EPOLL_CTL_DEL, sock, &ev);
+}
+
+
+/* wait for socket activity, returns > 0 if the wakeup feed needs draining */
+static int worker_poll_wait (worker_t *worker, int duration)
+{
+    struct epoll_event events [64];
+    int i, ret, wakeup = 0;
+
+    ret = epoll_wait (worker->epoll_fd, events, 64, duration);
+    for (i = 0; i < ret; i++)
+    {
+        sock_t sock = events[i].data.fd;
+        client_t *client;
+
+        if (sock == worker->wakeup_fd[0])
+        {
+            wakeup = 1;
+            continue;
+        }
+        client = sock < worker->poll_map_len ? worker->poll_map [sock] : NULL;
+        if (client == NULL || client->worker_sock != sock)
+        {
+            epoll_ctl (worker->epoll_fd, EPOLL_CTL_DEL, sock, &events[i]);
+            continue;
+        }
+        client->schedule_ms = worker->time_ms;
+        worker_heap_update (worker, client);
+    }
+    if (ret < 0)
+        return ret;
+    return wakeup;
+}
+#else
+#define worker_poll_add(w,c)        do {} while (0)
+#define worker_poll_remove(w,c,s)   do {} while (0)
+#endif
+
+
+/* let the kernel pace sends to the client at rate bytes per second, with the
+ * socket only accepting more once unsent data drops below lowat. A rate of 0
+ * returns the socket to normal sends.
+ */
+int client_set_pacing (client_t *client, unsigned int rate, unsigned int lowat)
+{
+    sock_t sock = client->connection.sock;
+
+    if (rate == 0)
+    {
+        sock_set_pacing_rate (sock, ~0U);
+        sock_set_notsent_lowat (sock, 0);
+        client->flags &= ~CLIENT_KERNEL_PACED;
+    }
+    else
+    {
+        client->paced_rate = rate;  // not retried if unsupported
+        if (sock_set_pacing_rate (sock, rate) < 0)
+            return -1;
+        if (sock_set_notsent_lowat (sock, lowat) < 0)
+        {
+            sock_set_pacing_rate (sock, ~0U);   // paced in userspace instead, so no cap
+            return -1;
+        }
+        client->flags |= CLIENT_KERNEL_PACED;
+    }
+    client->paced_rate = rate;
+    return 0;
+}
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* listener sends can be queued during a worker pass and submitted together at
+ * the end of it with a single io_uring_enter. Sends do not wait for socket
+ * space so all complete within that call and are applied before the worker
+ * waits, which means a client never has more than one send outstanding and
+ * is not touched by anything else in between. Queued blocks are referenced
+ * until the result is in.
+ */
+#define WORKER_SEND_ENTRIES     256
+#define WORKER_SEND_BLOCKS      8
+
+typedef struct
+{
+    client_t *client;
+    void (*complete)(client_t *client, refbuf_t *first, unsigned int len, int ret);
+    unsigned int len, count;
+    refbuf_t *blocks [WORKER_SEND_BLOCKS];
+    struct iovec iov [WORKER_SEND_BLOCKS];
+    struct msghdr msg;
+} worker_send_t;
+
+struct _worker_uring
+{
+    int fd;
+    unsigned int entries, queued;
+    unsigned *sq_tail, *sq_mask;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len, sqes_len;
+    worker_send_t sends [WORKER_SEND_ENTRIES];
+};
+
+
+static void worker_uring_destroy (worker_t *worker)
+{
+    struct _worker_uring *ring = worker->uring;
+
+    if (ring == NULL)
+        return;
+    if (ring->sqes && ring->sqes != MAP_FAILED)
+        munmap (ring->sqes, ring->sqes_len);
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap (ring->cq_ring, ring->cq_ring_len);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+        munmap (ring->sq_ring, ring->sq_ring_len);
+    if (ring->fd >= 0)
+        close (ring->fd);
+    free (ring);
+    worker->uring = NULL;
+}
+
+
+static void worker_uring_create (worker_t *worker)
+{
+    struct io_uring_params params;
+    struct _worker_uring *ring = calloc (1, sizeof (*ring));
+    struct io_uring_probe *probe;
+    unsigned int i, *array;
+
+    memset (&params, 0, sizeof (params));
+    worker->uring = ring;
+    ring->fd = syscall (__NR_io_uring_setup, WORKER_SEND_ENTRIES, &params);
+    if (ring->fd < 0)
+    {
+        WARN1 ("io_uring unavailable (%s), sending directly", strerror (errno));
+        worker_uring_destroy (worker);
+        return;
+    }
+    ring->entries = params.sq_entries < WORKER_SEND_ENTRIES ? params.sq_entries : WORKER_SEND_ENTRIES;
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    ring->sqes_len = params.sq_entries * sizeof (struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_len > ring->sq_ring_len)
+            ring->sq_ring_len = ring->cq_ring_len;
+        ring->cq_ring_len = ring->sq_ring_len;
+    }
+    ring->sq_ring = mmap (NULL, ring->sq_ring_len, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring->cq_ring = ring->sq_ring;
+    else
+        ring->cq_ring = mmap (NULL, ring->cq_ring_len, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap (NULL, ring->sqes_len, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        WARN1 ("io_uring mapping failed (%s), sending directly", strerror (errno));
+        worker_uring_destroy (worker);
+        return;
+    }
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ring + params.sq_off.ring_mask);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + params.cq_off.cqes);
+    // submission slots are always used in ring order
+    array = (unsigned *)((char *)ring->sq_ring + params.sq_off.array);
+    for (i = 0; i < params.sq_entries; i++)
+        array[i] = i;
+
+    probe = calloc (1, sizeof (*probe) + IORING_OP_LAST * sizeof (struct io_uring_probe_op));
+    if (syscall (__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0 ||
+            probe->last_op < IORING_OP_SENDMSG || (probe->ops [IORING_OP_SENDMSG].flags & IO_URING_OP_SUPPORTED) == 0)
+    {
+        WARN0 ("io_uring does not support sendmsg, sending directly");
+        worker_uring_destroy (worker);
+    }
+    free (probe);
+}
+
+
+static void worker_send_complete (worker_send_t *send, int ret)
+{
+    unsigned int i;
+
+    send->complete (send->client, send->blocks[0], send->len, ret);
+    for (i = 0; i < send->count; i++)
+        refbuf_release (send->blocks[i]);
+    send->client = NULL;
+}
+
+
+/* submit the sends queued during this pass and apply their results */
+static void worker_send_flush (worker_t *worker)
+{
+    struct _worker_uring *ring = worker->uring;
+    unsigned int pending, to_submit;
+
+    if (ring == NULL || ring->queued == 0)
+        return;
+    pending = to_submit = ring->queued;
+    atomic_store_release (ring->sq_tail, *ring->sq_tail + ring->queued);
+    while (pending)
+    {
+        unsigned int head, tail;
+        int ret = syscall (__NR_io_uring_enter, ring->fd, to_submit, pending, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (ret < 0)
+        {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                break;
+        }
+        else
+            to_submit -= ret < (int)to_submit ? ret : to_submit;
+        worker->batch_submits++;
+
+        head = *ring->cq_head;
+        tail = atomic_load_acquire (ring->cq_tail);
+        for (; head != tail && pending; head++, pending--)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes [head & *ring->cq_mask];
+
+            worker_send_complete (&ring->sends [cqe->user_data], cqe->res);
+        }
+        atomic_store_release (ring->cq_head, head);
+    }
+    if (pending)
+    {
+        unsigned int i;
+
+        // the ring is unusable, so fail what is left as unsent and send directly from now on
+        ERROR1 ("io_uring submission failed (%s), sending directly", strerror (errno));
+        for (i = 0; i < ring->queued; i++)
+            if (ring->sends [i].client)
+                worker_send_complete (&ring->sends [i], -EAGAIN);
+        worker_uring_destroy (worker);
+        return;
+    }
+    ring->queued = 0;
+}
+
+
+/* queue a send of the blocks from refbuf at pos, up to limit bytes, for the
+ * end of this worker pass. complete is called with the result, as a byte
+ * count or negative errno. Returns 0 if queued, -1 if a direct send is needed
+ */
+int client_send_queue (client_t *client, refbuf_t *refbuf, unsigned int pos, unsigned int limit,
+        void (*complete)(client_t *client, refbuf_t *first, unsigned int len, int ret))
+{
+    struct _worker_uring *ring = client->worker->uring;
+    struct io_uring_sqe *sqe;
+    worker_send_t *send;
+
+    if (ring == NULL || ring->queued == ring->entries)
+        return -1;
+#ifdef HAVE_OPENSSL
+    if (client->connection.ssl)
+        return -1;
+#endif
+    send = &ring->sends [ring->queued];
+    send->len = send->count = 0;
+    while (refbuf && send->count < WORKER_SEND_BLOCKS && send->len < limit)
+    {
+        unsigned int len = refbuf->len - pos;
+
+        if (len > limit - send->len)
+            len = limit - send->len;
+        send->iov [send->count].iov_base = refbuf->data + pos;
+        send->iov [send->count].iov_len = len;
+        send->blocks [send->count++] = refbuf;
+        refbuf_addref (refbuf);
+        send->len += len;
+        refbuf = refbuf->next;
+        pos = 0;
+    }
+    if (send->len == 0)
+    {
+        while (send->count)
+            refbuf_release (send->blocks [--send->count]);
+        return -1;
+    }
+    memset (&send->msg, 0, sizeof (send->msg));
+    send->msg.msg_iov = send->iov;
+    send->msg.msg_iovlen = send->count;
+    send->client = client;
+    send->complete = complete;
+
+    sqe = &ring->sqes [(*ring->sq_tail + ring->queued) & *ring->sq_mask];
+    memset (sqe, 0, sizeof (*sqe));
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = client->connection.sock;
+    sqe->addr = (unsigned long)&send->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+    sqe->user_data = ring->queued;
+    ring->queued++;
+    client->worker->batched_sends++;
+    client_gathered_send (client, send->count);
+    return 0;
+}
+#else
+#define worker_send_flush(w)        do {} while (0)
+
+int client_send_queue (client_t *client, refbuf_t *refbuf, unsigned int pos, unsigned int limit,
+        void (*complete)(client_t *client, refbuf_t *first, unsigned int len, int ret))
+{
+    return -1;
+}
+#endif
+
+
+/* the wakeup feed is an eventfd where possible, used for both ends, or a pipe */
 static void worker_control_create (worker_t *worker)
 {
-    if (pipe_create (&worker->wakeup_fd[0]) < 0)
+#ifdef HAVE_SYS_EVENTFD_H
+    worker->wakeup_fd[0] = worker->wakeup_fd[1] = eventfd (0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (worker->wakeup_fd[0] < 0)
+#endif
     {
-        ERROR0 ("pipe failed, descriptor limit?");
-        abort();
+        if (pipe_create (&worker->wakeup_fd[0]) < 0)
+        {
+            ERROR0 ("pipe failed, descriptor limit?");
+            abort();
+        }
+        sock_set_blocking (worker->wakeup_fd[0], 0);
+        sock_set_blocking (worker->wakeup_fd[1], 0);
     }
-    sock_set_blocking (worker->wakeup_fd[0], 0);
-    sock_set_blocking (worker->wakeup_fd[1], 0);
+#ifdef HAVE_SYS_EPOLL_H
+    if (worker->epoll_fd >= 0)
+    {
+        struct epoll_event ev;
+
+        memset (&ev, 0, sizeof (ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = worker->wakeup_fd[0];
+        if (epoll_ctl (worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup_fd[0], &ev) < 0)
+        {
+            WARN1 ("unable to add wakeup feed to epoll (%s)", strerror (errno));
+            worker_poll_destroy (worker);
+        }
+    }
+#endif
+}
+
+
+static void worker_control_close (worker_t *worker)
+{
+    if (worker->wakeup_fd[1] != worker->wakeup_fd[0])
+        sock_close (worker->wakeup_fd[1]);
+    sock_close (worker->wakeup_fd[0]);
 }
 
 
-static client_t **worker_add_pending_clients (worker_t *worker)
+static void worker_add_pending_clients (worker_t *worker)
 {
     if (worker->pending_clients)
     {
-        unsigned count;
-        client_t **p;
-
-        thread_spin_lock (&worker->lock);
-        p = worker->last_p;
-        *worker->last_p = worker->pending_clients;
-        worker->last_p = worker->pending_clients_tail;
-        worker->count += worker->pending_count;
-        count = worker->pending_count;
-        worker->pending_clients = NULL;
-        worker->pending_clients_tail = &worker->pending_clients;
-        worker->pending_count = 0;
-        thread_spin_unlock (&worker->lock);
+        unsigned count = 0;
+        client_t *client = atomic_swap (&worker->pending_clients, NULL), *prev = NULL;
+
+        while (client)  /* reverse into arrival order */
+        {
+            client_t *next = client->next_on_worker;
+
+            client->next_on_worker = prev;
+            prev = client;
+            client = next;
+            count++;
+        }
+        atomic_sub (&worker->pending_count, count);
         DEBUG2 ("Added %d pending clients to %p", count, worker);
-        if (worker->wakeup_ms > worker->time_ms+5)
-            return p;  /* only these new ones scheduled so process from here */
+        client = prev;
+        while (client)
+        {
+            client_t *next = client->next_on_worker;
+
+            client->next_on_worker = NULL;
+            client->worker_ms = client->schedule_ms;
+            worker_heap_add (worker, client);
+            if (worker_has_readiness (worker))
+            {
+                client->worker_sock = SOCK_ERROR;
+                worker_poll_add (worker, client);
+            }
+            client = next;
+        }
     }
-    worker->wakeup_ms = worker->time_ms + 60000;
-    return &worker->clients;
 }
 
 
-static client_t **worker_wait (worker_t *worker)
+static void worker_wait (worker_t *worker)
 {
     int ret, duration = 2;
 
@@ -577,17 +1903,28 @@ static client_t **worker_wait (worker_t *worker)
     {
         uint64_t tm = timing_get_time();
         if (tm - worker->time_ms > 1000 && worker->time_ms)
+        {
             WARN2 ("worker %p has been stuck for %lu ms", worker, (unsigned long)(tm - worker->time_ms));
+            worker->stalls++;
+        }
         if (worker->wakeup_ms > tm)
             duration = (int)(worker->wakeup_ms - tm);
         if (duration > 60000) /* make duration at most 60s */
             duration = 60000;
     }
 
-    ret = util_timed_wait_for_fd (worker->wakeup_fd[0], duration);
+    // no shared data is held while waiting, ordered after this pass's reads of it
+    atomic_store_release (&worker->pools.epoch, 0);
+#ifdef HAVE_SYS_EPOLL_H
+    if (worker->epoll_fd >= 0)
+        ret = worker_poll_wait (worker, duration);
+    else
+#endif
+        ret = util_timed_wait_for_fd (worker->wakeup_fd[0], duration);
     if (ret > 0) /* may of been several wakeup attempts */
     {
         char ca[100];
+
         do
         {
             ret = pipe_read (worker->wakeup_fd[0], ca, sizeof ca);
@@ -595,18 +1932,44 @@ static client_t **worker_wait (worker_t *worker)
                 break;
             if (ret < 0 && sock_recoverable (sock_error()))
                 break;
-            sock_close (worker->wakeup_fd[1]);
-            sock_close (worker->wakeup_fd[0]);
+            worker_control_close (worker);
             worker_control_create (worker);
             worker_wakeup (worker);
             WARN0 ("Had to recreate worker control feed");
         } while (1);
+        // clear once drained, a wakeup from here on signals again. Any made
+        // before are covered by the pending clients being added below
+        atomic_swap (&worker->wakeup_signalled, 0);
+        atomic_barrier();
     }
 
     worker->time_ms = timing_get_time();
     worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
 
-    return worker_add_pending_clients (worker);
+    worker_add_pending_clients (worker);
+}
+
+
+/* pick where a client of a stopping worker goes, the load its clients have
+ * been adding is counted against each worker for those already handed over
+ */
+static worker_t *worker_relocate_dest (unsigned int client_load)
+{
+    worker_t *handler, *dest = workers;
+    unsigned int dest_load = 0;
+
+    for (handler = workers; handler; handler = handler->next)
+    {
+        unsigned int load = handler->load + handler->pending_count * client_load;
+
+        if (handler == workers || load < dest_load || (load == dest_load &&
+                    handler->count + handler->pending_count < dest->count + dest->pending_count))
+        {
+            dest = handler;
+            dest_load = load;
+        }
+    }
+    return dest;
 }
 
 
@@ -616,36 +1979,34 @@ static void worker_relocate_clients (worker_t *worker)
         return;
     while (worker->count || worker->pending_count)
     {
-        client_t *client = worker->clients, **prevp = &worker->clients;
+        unsigned int client_load = worker->count ? worker->load / worker->count : 0;
+        worker_t *handler;
+        int i, moved = 0;
 
         worker->wakeup_ms = worker->time_ms + 150;
-        while (client)
+        for (i = 0; i < worker->count; i++)
+            client_wait_cancel (worker->heap [i]);
+        worker_woken_check (worker);
+        thread_rwlock_rlock (&workers_lock);
+        for (i = 0; i < worker->count; i++)
         {
+            client_t *client = worker->heap [i];
+
+            client->next_on_worker = NULL;
+            worker_poll_remove (worker, client, client->worker_sock);
             if (client->flags & CLIENT_ACTIVE)
             {
-                client->worker = workers;
-                prevp = &client->next_on_worker;
+                worker_add_client (worker_relocate_dest (client_load), client);
+                moved = 1;
             }
             else
-            {
-                *prevp = client->next_on_worker;
                 worker_add_client (worker, client);
-                worker->count--;
-            }
-            client = *prevp;
-        }
-        if (worker->clients)
-        {
-            thread_spin_lock (&workers->lock);
-            *workers->pending_clients_tail = worker->clients;
-            workers->pending_clients_tail = prevp;
-            workers->pending_count += worker->count;
-            thread_spin_unlock (&workers->lock);
-            worker_wakeup (workers);
-            worker->clients = NULL;
-            worker->last_p = &worker->clients;
-            worker->count = 0;
         }
+        worker->count = 0;
+        if (moved)
+            for (handler = workers; handler; handler = handler->next)
+                worker_wakeup (handler);
+        thread_rwlock_unlock (&workers_lock);
         worker_wait (worker);
     }
 }
@@ -654,73 +2015,141 @@ void *worker (void *arg)
 {
     worker_t *worker = arg;
     long prev_count = -1;
-    client_t **prevp = &worker->clients;
     uint64_t c = 0;
 
+    // buffers and pool entries first touched here stay on the worker's node, clients
+    // handed over, eg listeners set up on the connection thread, stay where they were
+    if (worker->cpu >= 0)
+        util_set_cpu_affinity (NULL, worker->cpu);
+    client_pools_attach (&worker->pools);
     worker->running = 1;
     worker->wakeup_ms = (int64_t)0;
     worker->time_ms = timing_get_time();
 
+    worker->load_ms = worker->time_ms + 1000;
+
     while (1)
     {
-        client_t *client = *prevp;
-        uint64_t sched_ms = worker->time_ms + 12;
+        client_t *deferred = NULL;
+        uint64_t sched_ms = worker->running ? worker->time_ms + 12 : (uint64_t)-1;
+        struct timespec pass_start, mark, now;
+        int64_t busy;
+
+        thread_get_timespec (&pass_start);
+        mark = pass_start;
+        // published before any shared data is read in this pass
+        atomic_store_relaxed (&worker->pools.epoch, atomic_load_acquire (&worker_epoch));
+        atomic_barrier();
+
+        if (worker->scan_ms <= worker->time_ms)
+            worker_heap_rescan (worker);
+        worker_woken_check (worker);
 
         c = 0;
-        while (client)
+        while (worker->count)
         {
+            client_t *client = worker->heap[0];
+            sock_t sock = client->worker_sock;
+            int ret, kind;
+
+            if (client->worker_ms > sched_ms)
+                break;  /* nothing else is due */
             if (client->worker != worker) abort();
-            /* process client details but skip those that are not ready yet */
-            if (client->flags & CLIENT_ACTIVE)
+            if ((client->flags & CLIENT_ACTIVE) == 0)
             {
-                int ret = 0;
-                client_t *nx = client->next_on_worker;
-
-                int process = (worker->running == 0 || client->schedule_ms <= sched_ms) ? 1 : 0;
-                if (process)
-                {
-                    if (c > 300 && c & 1)  // only process alternate clients after so many
-                       process = 0;
-                }
-                else if (client->wakeup && *client->wakeup)
-                {
-                    if (c & 1)
-                        process = 1; // enable this one to pass through
-                    else
-                        client->schedule_ms = worker->time_ms;
-                }
+                /* park it, a rescan picks it up once reactivated */
+                worker_heap_remove (worker, client->worker_slot);
+                client->worker_ms = worker->time_ms + 1000;
+                client->next_on_worker = deferred;
+                deferred = client;
+                continue;
+            }
+            if (client->schedule_ms > sched_ms)
+            {
+                worker_heap_update (worker, client);  /* pushed back since placed */
+                continue;
+            }
 
-                if (process)
+            c++;
+            if ((c & 31) == 0)
+            {
+                // update these after so many to keep in sync
+                worker->time_ms = (uint64_t)mark.tv_sec * 1000 + mark.tv_nsec / 1000000;
+                worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
+            }
+            if (client->schedule_ms && worker->time_ms > client->schedule_ms)
+                worker_hist_add (&worker->lag_ms, worker->time_ms - client->schedule_ms);
+            else
+                worker_hist_add (&worker->lag_ms, 0);
+            kind = client->ops->kind;
+            ret = client->ops->process (client);
+            thread_get_timespec (&now);
+            busy = worker_time_diff (&mark, &now);
+            worker_hist_add (&worker->process_us [kind], busy > 0 ? busy : 0);
+            mark = now;
+            if (worker_has_readiness (worker))
+            {
+                if (ret)
+                    worker_poll_remove (worker, client, sock);
+                else if (client->connection.sock != client->worker_sock)
+                    worker_poll_add (worker, client);  // socket changed, eg relay reconnect
+            }
+            if (ret)
+            {
+                /* a moved client may already be on another worker so leave it alone */
+                worker_heap_remove (worker, 0);
+                if (ret < 0)
                 {
-                    c++;
-                    if ((c & 31) == 0)
-                    {
-                        // update these after so many to keep in sync
-                        worker->time_ms = timing_get_time();
-                        worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
-                    }
-                    ret = client->ops->process (client);
-                    if (ret < 0)
-                    {
-                        client->worker = NULL;
-                        if (client->ops->release)
-                            client->ops->release (client);
-                    }
-                    if (ret)
-                    {
-                        worker->count--;
-                        if (nx == NULL) /* is this the last client */
-                            worker->last_p = prevp;
-                        client = *prevp = nx;
-                        continue;
-                    }
+                    client_wait_cancel (client);
+                    if (client->woken)
+                        worker_woken_check (worker);
+                    client->worker = NULL;
+                    if (client->ops->release)
+                        client->ops->release (client);
                 }
-                if ((client->flags & CLIENT_ACTIVE) && client->schedule_ms < worker->wakeup_ms)
-                    worker->wakeup_ms = client->schedule_ms;
+                continue;
             }
-            prevp = &client->next_on_worker;
-            client = *prevp;
+            if (client->schedule_ms <= sched_ms)
+            {
+                /* due again, but only process each client once per pass */
+                worker_heap_remove (worker, client->worker_slot);
+                client->worker_ms = client->schedule_ms;
+                client->next_on_worker = deferred;
+                deferred = client;
+                continue;
+            }
+            worker_heap_update (worker, client);
+        }
+        worker_send_flush (worker);
+        while (deferred)
+        {
+            client_t *client = deferred;
+
+            deferred = client->next_on_worker;
+            client->next_on_worker = NULL;
+            worker_heap_add (worker, client);
+        }
+        thread_get_timespec (&now);
+        busy = worker_time_diff (&pass_start, &now);
+        if (busy > 0)
+            worker->busy_us += busy;
+        if (c)
+        {
+            worker_hist_add (&worker->loop_us, busy > 0 ? busy : 0);
+            worker_hist_add (&worker->pass_clients, c);
+        }
+        if (worker->time_ms >= worker->load_ms)
+            worker_load_update (worker);
+
+        worker->wakeup_ms = worker->time_ms + 60000;
+        if (worker->count)
+        {
+            worker->wakeup_ms = worker->heap[0]->worker_ms;
+            if (worker->scan_ms < worker->wakeup_ms)
+                worker->wakeup_ms = worker->scan_ms;
         }
+        if (worker->load_ms < worker->wakeup_ms)
+            worker->wakeup_ms = worker->load_ms;
         if (prev_count != worker->count)
         {
             DEBUG2 ("%p now has %d clients", worker, worker->count);
@@ -733,83 +2162,153 @@ void *worker (void *arg)
             if (worker->count == 0 && worker->pending_count == 0)
                 break;
         }
-        prevp = worker_wait (worker);
+        worker_wait (worker);
     }
     worker_relocate_clients (worker);
+    client_pools_detach (&worker->pools);
     INFO0 ("shutting down");
+    atomic_store_release (&worker->finished, 1);
     return NULL;
 }
 
 
-// We pick a worker (consequetive) and set a max number of clients to move if needed
+// refresh the preferred worker for new clients and report the worker details
 void worker_balance_trigger (time_t now)
 {
-    int log_counts = (now % 10) == 0 ? 1 : 0;
+    int log_counts = (now % 10) == 0 ? 1 : 0, len = 0, plen = 0, tlen = 0;
+    char buffer [200], placement [200], timings [300];
+    worker_t *handler;
 
-    if (worker_count == 1)
-        return; // no balance required, leave quickly
     thread_rwlock_rlock (&workers_lock);
-
-    // lets only search for this once a second, not many times
-    worker_least_used = find_least_busy_handler (log_counts);
-    if (worker_balance_to_check)
+    buffer[0] = placement[0] = timings[0] = '\0';
+    for (handler = workers; handler && len < (int)sizeof (buffer) - 12; handler = handler->next)
     {
-        worker_balance_to_check->move_allocations = 50;
-        worker_balance_to_check = worker_balance_to_check->next;
+        len += snprintf (buffer + len, sizeof (buffer) - len, "%s%u.%u", len ? "," : "",
+                handler->load / 10, handler->load % 10);
+        // 99th percentiles over the last second, loop us/clients per pass/lag ms
+        if (tlen < (int)sizeof (timings) - 40)
+            tlen += snprintf (timings + tlen, sizeof (timings) - tlen, "%s%" PRIu64 "/%" PRIu64 "/%" PRIu64,
+                    tlen ? "," : "", handler->loop_us.recent_p99, handler->pass_clients.recent_p99,
+                    handler->lag_ms.recent_p99);
+        if (plen < (int)sizeof (placement) - 24)
+        {
+            if (handler->cpu < 0)
+                plen += snprintf (placement + plen, sizeof (placement) - plen, "%sany", plen ? "," : "");
+            else
+                plen += snprintf (placement + plen, sizeof (placement) - plen, "%s%d:%d", plen ? "," : "",
+                        handler->cpu, handler->node);
+        }
     }
-    if (worker_balance_to_check == NULL)
-        worker_balance_to_check = workers;
 
+    // lets only search for this once a second, not many times
+    if (worker_count > 1)
+        worker_least_used = find_least_busy_handler (log_counts);
     thread_rwlock_unlock (&workers_lock);
+    stats_event (NULL, "worker_load", buffer);
+    stats_event (NULL, "worker_placement", placement);
+    stats_event (NULL, "worker_timings", timings);
+    client_pools_stats ();
 }
 
 
 static void worker_start (void)
 {
     worker_t *handler = calloc (1, sizeof(worker_t));
+    ice_config_t *config = config_get_config_unlocked();
+
+    handler->cpu = util_cpu_from_list (config->worker_cpus, worker_count);
+    handler->node = util_cpu_node (handler->cpu);
 
+#ifdef HAVE_SYS_EPOLL_H
+    handler->epoll_fd = -1;
+    if (config->workers_epoll)
+        worker_poll_create (handler);
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+    if (config->workers_uring)
+        worker_uring_create (handler);
+#endif
     worker_control_create (handler);
 
-    handler->pending_clients_tail = &handler->pending_clients;
-    thread_spin_create (&handler->lock);
     thread_rwlock_wlock (&workers_lock);
-    handler->last_p = &handler->clients;
     handler->next = workers;
     workers = handler;
     worker_count++;
-    worker_least_used = worker_balance_to_check = workers;
+    worker_least_used = workers;
     handler->thread = thread_create ("worker", worker, handler, THREAD_ATTACHED);
     thread_rwlock_unlock (&workers_lock);
 }
 
 
+/* stopped workers, left to finish relocating their clients */
+static worker_t *workers_stopping;
+
+/* a stopping worker is flagged and collected later, from workers_collect */
 static void worker_stop (void)
 {
-    worker_t *handler;
+    worker_t *handler, *other;
 
     if (workers == NULL)
         return;
     thread_rwlock_wlock (&workers_lock);
     handler = workers;
     workers = handler->next;
-    worker_least_used = worker_balance_to_check = workers;
-    if (workers)
-        workers->move_allocations = 100;
+    worker_least_used = workers;
+    for (other = workers; other; other = other->next)
+        if (other->steal_to == handler)
+            other->steal_to = NULL;
     worker_count--;
+    // other workers may still be checking its load without the workers lock
+    handler->retired = worker_epoch_retire ();
+    handler->next = workers_stopping;
+    workers_stopping = handler;
     thread_rwlock_unlock (&workers_lock);
 
     handler->running = 0;
     worker_wakeup (handler);
+}
+
+
+/* release the stopped workers that are done, waiting on them if asked */
+static void workers_collect (int wait)
+{
+    worker_t **trail = &workers_stopping;
+
+    thread_rwlock_wlock (&workers_lock);
+    while (*trail)
+    {
+        worker_t *handler = *trail;
+
+        if (wait == 0 && (atomic_load_acquire (&handler->finished) == 0 ||
+                    worker_epoch_passed (handler->retired) == 0))
+        {
+            trail = &handler->next;
+            continue;
+        }
+        *trail = handler->next;
+        thread_rwlock_unlock (&workers_lock);
 
-    thread_join (handler->thread);
-    thread_spin_destroy (&handler->lock);
+        thread_join (handler->thread);
+        while (worker_epoch_passed (handler->retired) == 0)
+            thread_sleep (1000);
+        free (handler->heap);
 
-    sock_close (handler->wakeup_fd[1]);
-    sock_close (handler->wakeup_fd[0]);
-    free (handler);
+        worker_control_close (handler);
+#ifdef HAVE_SYS_EPOLL_H
+        worker_poll_destroy (handler);
+#endif
+#ifdef HAVE_LINUX_IO_URING_H
+        worker_uring_destroy (handler);
+#endif
+        free (handler);
+        thread_rwlock_wlock (&workers_lock);
+        trail = &workers_stopping;
+    }
+    thread_rwlock_unlock (&workers_lock);
 }
 
 
+/* workers removed here finish in the background unless all are going */
 void workers_adjust (int new_count)
 {
     INFO1 ("requested worker count %d", new_count);
@@ -820,10 +2319,112 @@ void workers_adjust (int new_count)
         else if (worker_count > new_count)
             worker_stop ();
     }
+    workers_collect (new_count == 0);
+}
+
+
+/* with autoscaling the configured count is only used at startup, after which
+ * the current count is kept within the bounds.
+ */
+void workers_apply_config (ice_config_t *config)
+{
+    int count = config->workers_count;
+
+    if (config->workers_max > config->workers_min)
+    {
+        if (worker_count)
+            count = worker_count;
+        if (count < config->workers_min) count = config->workers_min;
+        if (count > config->workers_max) count = config->workers_max;
+    }
+    workers_adjust (count);
+}
+
+
+/* Called once a second. Workers are added when on average they are busy or
+ * clients are being processed late, and removed when the remaining workers
+ * would still be mostly idle. Either has to persist for a while and changes
+ * are spaced out so the count does not flap.
+ */
+#define WORKER_LAG_HIGH         100     /* ms, 99th percentile */
+#define WORKER_LAG_LOW          20
+
+void worker_autoscale (time_t now)
+{
+    static int scale_up, scale_down;
+    static time_t scale_next;
+    unsigned int total = 0, max_lag = 0;
+    ice_config_t *config;
+    worker_t *handler;
+    int count, min, max;
+
+    if (workers_stopping)
+        workers_collect (0);
+    thread_rwlock_rlock (&workers_lock);
+    for (handler = workers; handler; handler = handler->next)
+    {
+        total += handler->load;
+        if (handler->lag_ms.recent_p99 > max_lag)
+            max_lag = (unsigned int)handler->lag_ms.recent_p99;
+    }
+    count = worker_count;
+    thread_rwlock_unlock (&workers_lock);
+    if (count == 0)
+        return;
+
+    if (total / count > WORKER_LOAD_HIGH || max_lag >= WORKER_LAG_HIGH)
+    {
+        scale_up++;
+        scale_down = 0;
+    }
+    else if (count > 1 && total / (count - 1) < WORKER_LOAD_IDLE && max_lag < WORKER_LAG_LOW)
+    {
+        scale_down++;
+        scale_up = 0;
+    }
+    else
+        scale_up = scale_down = 0;
+    if (now < scale_next)
+        return;
+
+    config = config_get_config();
+    min = config->workers_min;
+    max = config->workers_max;
+    config_release_config();
+    if (max > min)
+    {
+        int target = count;
+
+        if (scale_up >= 5 && count < max)
+            target++;
+        else if (scale_down >= 60 && count > min)
+            target--;
+        if (target != count)
+        {
+            INFO4 ("workers %s, load %u.%u%%, lag %ums", target > count ? "saturated" : "idle",
+                    total / count / 10, total / count % 10, max_lag);
+            workers_adjust (target);
+            scale_up = scale_down = 0;
+            scale_next = now + 30;
+        }
+    }
 }
 
 
+/* repeated wakeups before the worker gets to run only need the one signal */
 void worker_wakeup (worker_t *worker)
 {
+    atomic_barrier();
+    if (atomic_swap (&worker->wakeup_signalled, 1))
+        return;
+#ifdef HAVE_SYS_EVENTFD_H
+    if (worker->wakeup_fd[1] == worker->wakeup_fd[0])
+    {
+        uint64_t v = 1;
+        if (write (worker->wakeup_fd[1], &v, sizeof v) < 0)
+            worker->wakeup_signalled = 0;
+        return;
+    }
+#endif
     pipe_write (worker->wakeup_fd[1], "W", 1);
 }
@@ -28,25 +28,93 @@ typedef struct _worker_t worker_t;
 #include "compat.h"
 #include "thread/thread.h"
 
+/* kinds of client processing, as marked in the client functions */
+#define CLIENT_OPS_OTHER            0
+#define CLIENT_OPS_LISTENER         1
+#define CLIENT_OPS_SOURCE           2
+#define CLIENT_OPS_FSERVE           3
+#define CLIENT_OPS_STATS            4
+#define CLIENT_OPS_RELAY            5
+#define CLIENT_OPS_KINDS            6
+
+/* counts in power of 2 ranges, bucket 0 is for 0, bucket n covers up
+ * to (1<<n)-1 and the last takes everything above. recent is filled in by
+ * the worker and folded into the totals once a second.
+ */
+#define WORKER_HIST_BUCKETS         20
+
+typedef struct
+{
+    uint64_t bucket [WORKER_HIST_BUCKETS];
+    uint64_t count, sum;
+    uint64_t recent [WORKER_HIST_BUCKETS];
+    uint64_t recent_sum;
+    uint64_t recent_p99;    /* bucket limit, from the last folding */
+} worker_hist_t;
+
+/* freed clients and parsers kept for reuse by a thread, along with buffers */
+#define CLIENT_POOL_CLIENT          0
+#define CLIENT_POOL_PARSER          1
+#define CLIENT_POOL_TYPES           2
+
+typedef struct _client_pools_t
+{
+    void *free [CLIENT_POOL_TYPES];     /* chained through the first pointer */
+    unsigned int count [CLIENT_POOL_TYPES];
+    uint64_t hits [CLIENT_POOL_TYPES], misses [CLIENT_POOL_TYPES];
+    refbuf_cache_t refbufs;
+    uint64_t epoch;     /* epoch seen at the start of a worker pass, 0 when idle */
+    struct _client_pools_t *next;
+} client_pools_t;
+
+/* clients waiting on an event, eg listeners caught up with their source */
+typedef struct
+{
+    spin_t lock;
+    client_t *first;
+} client_waiters_t;
+
 struct _worker_t
 {
     int running;
+    int finished;           /* set by the thread once it has no clients left */
+    uint64_t retired;       /* epoch at removal from the workers list */
     int count, pending_count;
     int move_allocations;
-    spin_t lock;
+    int cpu, node;          /* placement, -1 if not pinned or unknown */
+    unsigned int load;      /* permille of time spent processing, smoothed */
+    uint64_t busy_us, load_ms;
+    struct _worker_t *steal_to;     /* idle worker asking for clients */
+    int steal_count;
+    worker_hist_t loop_us;          /* processing time per pass */
+    worker_hist_t pass_clients;     /* clients processed per pass */
+    worker_hist_t lag_ms;           /* late processing compared to schedule */
+    worker_hist_t process_us [CLIENT_OPS_KINDS];
+    unsigned int stalls;
+    client_pools_t pools;
+    struct _worker_uring *uring;    /* batched listener sends, NULL if unused */
+    uint64_t batched_sends, batch_submits;
+    uint64_t gathered_sends, sends_saved;   /* sends of several queue blocks */
 #ifdef _WIN32
     SOCKET wakeup_fd[2];
 #else
-    int wakeup_fd[2];
+    int wakeup_fd[2];       /* same descriptor twice if an eventfd */
+#endif
+    int wakeup_signalled;
+    client_t *pending_clients;     /* lock-free stack, newest first */
+    client_t **heap;        /* 4-ary heap of clients ordered on schedule */
+    unsigned int heap_size;
+    client_t *woken;        /* lock-free stack of clients woken early */
+#ifdef HAVE_SYS_EPOLL_H
+    int epoll_fd;
+    unsigned int poll_map_len;
+    client_t **poll_map;    /* registered socket to client lookup */
 #endif
-    client_t *pending_clients;
-    client_t **pending_clients_tail,
-             *clients;
-    client_t **last_p;
     thread_type *thread;
     struct timespec current_time;
     uint64_t time_ms;
     uint64_t wakeup_ms;
+    uint64_t scan_ms;
     struct _worker_t *next;
 };
 
@@ -59,12 +127,18 @@ struct _client_functions
 {
     int  (*process)(struct _client_tag *client);
     void (*release)(struct _client_tag *client);
+    int  kind;      /* grouping for worker timings */
 };
 
 struct _client_tag
 {
     uint64_t schedule_ms;
-    char *wakeup;
+
+    /* while on a waiters list, and once woken until the worker takes it */
+    client_waiters_t *waiting_on;
+    client_t *wait_next, **wait_prev;
+    client_t *next_woken;
+    int woken;
 
     /* various states the client could be in */
     unsigned int flags;
@@ -74,6 +148,10 @@ struct _client_tag
 
     client_t *next_on_worker;
 
+    /* schedule as ordered in the worker heap, and positions held there */
+    uint64_t worker_ms;
+    unsigned int worker_slot;
+
     /* functions to process client */
     struct _client_functions *ops;
 
@@ -89,6 +167,15 @@ struct _client_tag
     /* the clients connection */
     connection_t connection;
 
+    /* socket registered with the worker readiness notifier */
+    sock_t worker_sock;
+
+    /* blocks held until the kernel completes zero copy sends of them */
+    struct _client_zerocopy *zerocopy;
+
+    /* send rate the kernel paces the socket to, when CLIENT_KERNEL_PACED */
+    unsigned int paced_rate;
+
     /* the client's http headers */
     http_parser_t *parser;
 
@@ -139,6 +226,13 @@ int  client_send_403redirect (client_t *client, const char *mount, const char *r
 int  client_send_400(client_t *client, const char *message);
 int  client_send_302(client_t *client, const char *location);
 int  client_send_bytes (client_t *client, const void *buf, unsigned len);
+int  client_send_queue (client_t *client, refbuf_t *refbuf, unsigned int pos, unsigned int limit,
+        void (*complete)(client_t *client, refbuf_t *first, unsigned int len, int ret));
+int  client_send_pinned (client_t *client, refbuf_t *refbuf, unsigned int pos, unsigned int limit);
+int  client_send_blocks (client_t *client, refbuf_t *refbuf, unsigned int pos, unsigned int limit);
+void client_gathered_send (client_t *client, unsigned int blocks);
+void client_send_backoff (client_t *client, int ret);
+int  client_set_pacing (client_t *client, unsigned int rate, unsigned int lowat);
 int  client_send_buffer_callback (client_t *client, int(*callback)(client_t*));
 int  client_read_bytes (client_t *client, void *buf, unsigned len);
 void client_set_queue (client_t *client, refbuf_t *refbuf);
@@ -149,10 +243,44 @@ const char *client_keepalive_header (client_t *client);
 int  client_change_worker (client_t *client, worker_t *dest_worker);
 void client_add_worker (client_t *client);
 worker_t *worker_selected (void);
+worker_t *worker_steal_dest (worker_t *worker, int weight);
+uint64_t worker_hist_limit (int bucket);
 void worker_balance_trigger (time_t now);
 void workers_adjust (int new_count);
+void workers_apply_config (struct ice_config_tag *config);
+void worker_autoscale (time_t now);
 void worker_wakeup (worker_t *worker);
 
+void client_waiters_init (client_waiters_t *waiters);
+void client_waiters_destroy (client_waiters_t *waiters);
+void client_waiters_wake (client_waiters_t *waiters);
+void client_wait_on (client_t *client, client_waiters_t *waiters);
+void client_wait_cancel (client_t *client);
+
+uint64_t worker_epoch_retire (void);
+int  worker_epoch_passed (uint64_t epoch);
+
+void client_pools_attach (client_pools_t *pools);
+void client_pools_detach (client_pools_t *pools);
+client_t *client_pool_client (void);
+void client_pool_free_client (client_t *client);
+http_parser_t *client_pool_parser (void);
+void client_pool_free_parser (http_parser_t *parser);
+
+/* worker load figures are in permille of time busy */
+#define WORKER_LOAD_IDLE            300
+#define WORKER_LOAD_HIGH            700
+#define WORKER_LOAD_MARGIN          200
+
+/* sends of at least this size may be made zero copy, 0 if disabled */
+#define client_zerocopy_size(c)     ((c)->server_conn ? (c)->server_conn->so_zerocopy : 0)
+
+#ifdef HAVE_SYS_EPOLL_H
+#define worker_has_readiness(w)     ((w)->epoll_fd >= 0)
+#else
+#define worker_has_readiness(w)     (0)
+#endif
+
 
 /* client flags bitmask */
 #define CLIENT_ACTIVE               (1)
@@ -169,6 +297,8 @@ void worker_wakeup (worker_t *worker);
 #define CLIENT_RANGE_END            (1<<11)
 #define CLIENT_KEEPALIVE            (1<<12)
 #define CLIENT_CHUNKED              (1<<13)
+#define CLIENT_QUEUE_LOCKLESS       (1<<14)
+#define CLIENT_KERNEL_PACED         (1<<15)
 #define CLIENT_FORMAT_BIT           (1<<16)
 
 #endif  /* __CLIENT_H__ */
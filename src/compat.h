@@ -59,5 +59,88 @@
 #include <malloc.h>
 #endif
 
+/* atomic operations. Read-modify-write operations and atomic_barrier are
+ * full barriers, loads and stores give the ordering named. gcc style
+ * __atomic builtins are also provided by clang and icc, msvc has the
+ * Interlocked functions and older gcc only the __sync builtins */
+#if defined(__ATOMIC_ACQUIRE)
+#define atomic_swap(p,v)            __atomic_exchange_n(p,v,__ATOMIC_SEQ_CST)
+#define atomic_cas(p,o,n)           __extension__ ({ __typeof__(*(p)) _atomic_o = (o); \
+        __atomic_compare_exchange_n(p,&_atomic_o,n,0,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST); })
+#define atomic_add(p,v)             __atomic_add_fetch(p,v,__ATOMIC_SEQ_CST)
+#define atomic_sub(p,v)             __atomic_sub_fetch(p,v,__ATOMIC_SEQ_CST)
+#define atomic_barrier()            __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define atomic_load_acquire(p)      __atomic_load_n(p,__ATOMIC_ACQUIRE)
+#define atomic_store_release(p,v)   __atomic_store_n(p,v,__ATOMIC_RELEASE)
+#define atomic_store_relaxed(p,v)   __atomic_store_n(p,v,__ATOMIC_RELAXED)
+/* reference counts, a new reference needs no ordering but a drop does */
+#define atomic_ref_inc(p)           __atomic_add_fetch(p,1,__ATOMIC_RELAXED)
+#define atomic_ref_dec(p)           __atomic_sub_fetch(p,1,__ATOMIC_ACQ_REL)
+
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define _atomic_64(p)               (sizeof(*(p)) == 8)
+#define atomic_swap(p,v)            (_atomic_64(p) ? \
+        _InterlockedExchange64((volatile __int64*)(p),(__int64)(v)) : \
+        _InterlockedExchange((volatile long*)(p),(long)(v)))
+#define atomic_cas(p,o,n)           (_atomic_64(p) ? \
+        _InterlockedCompareExchange64((volatile __int64*)(p),(__int64)(n),(__int64)(o)) == (__int64)(o) : \
+        _InterlockedCompareExchange((volatile long*)(p),(long)(n),(long)(o)) == (long)(o))
+#define atomic_add(p,v)             (_atomic_64(p) ? \
+        _InterlockedExchangeAdd64((volatile __int64*)(p),(__int64)(v)) + (v) : \
+        _InterlockedExchangeAdd((volatile long*)(p),(long)(v)) + (v))
+#define atomic_sub(p,v)             atomic_add(p,-(v))
+#define atomic_barrier()            _mm_mfence()
+/* x86 and x64 only reorder a store after a later load, so only the compiler
+ * needs holding back for these */
+#define atomic_load_acquire(p)      (_ReadWriteBarrier(), *(p))
+#define atomic_store_release(p,v)   do { _ReadWriteBarrier(); *(p) = (v); _ReadWriteBarrier(); } while (0)
+#define atomic_store_relaxed(p,v)   do { *(p) = (v); _ReadWriteBarrier(); } while (0)
+#define atomic_ref_inc(p)           atomic_add(p,1)
+#define atomic_ref_dec(p)           atomic_sub(p,1)
+
+#else
+#define atomic_swap(p,v)            (__sync_synchronize(), __sync_lock_test_and_set(p,v))
+#define atomic_cas(p,o,n)           __sync_bool_compare_and_swap(p,o,n)
+#define atomic_add(p,v)             __sync_add_and_fetch(p,v)
+#define atomic_sub(p,v)             __sync_sub_and_fetch(p,v)
+#define atomic_barrier()            __sync_synchronize()
+#define atomic_load_acquire(p)      __extension__ ({ __typeof__(*(p)) _atomic_v = *(volatile __typeof__(*(p)) *)(p); \
+        __sync_synchronize(); _atomic_v; })
+#define atomic_store_release(p,v)   do { __sync_synchronize(); *(volatile __typeof__(*(p)) *)(p) = (v); } while (0)
+#define atomic_store_relaxed(p,v)   do { *(volatile __typeof__(*(p)) *)(p) = (v); } while (0)
+#define atomic_ref_inc(p)           __sync_add_and_fetch(p,1)
+#define atomic_ref_dec(p)           __sync_sub_and_fetch(p,1)
+#endif
+
+/* bit scans of non-zero values */
+#if defined(_MSC_VER) && !defined(__clang__)
+static __inline int bit_clz64 (unsigned __int64 v)
+{
+    unsigned long i;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanReverse64 (&i, v);
+    return 63 - (int)i;
+#else
+    if (v >> 32)
+    {
+        _BitScanReverse (&i, (unsigned long)(v >> 32));
+        return 31 - (int)i;
+    }
+    _BitScanReverse (&i, (unsigned long)v);
+    return 63 - (int)i;
+#endif
+}
+static __inline int bit_ctz (unsigned int v)
+{
+    unsigned long i;
+    _BitScanForward (&i, v);
+    return (int)i;
+}
+#else
+#define bit_clz64(v)                __builtin_clzll(v)
+#define bit_ctz(v)                  __builtin_ctz(v)
+#endif
+
 #endif /* __COMPAT_H__ */
 
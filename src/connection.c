@@ -877,7 +877,7 @@ static client_t *accept_client (void)
             WARN0 ("failed to set tcp options on client connection, dropping");
             break;
         }
-        client = calloc (1, sizeof (client_t));
+        client = client_pool_client ();
         if (client == NULL || connection_init (&client->connection, sock, addr) < 0)
             break;
 
@@ -908,7 +908,7 @@ static client_t *accept_client (void)
         return client;
     } while (0);
 
-    free (client);
+    client_pool_free_client (client);
     sock_close (sock);
     return NULL;
 }
@@ -1103,7 +1103,7 @@ static int http_client_request (client_t *client)
             client->refbuf = client->shared_data;
             client->shared_data = NULL;
             client->connection.discon.time = 0;
-            client->parser = httpp_create_parser();
+            client->parser = client_pool_parser ();
             httpp_initialize (client->parser, NULL);
             if (httpp_parse (client->parser, refbuf->data, refbuf->len))
             {
@@ -1177,6 +1177,8 @@ static int http_client_request (client_t *client)
             diff >>= 1;
             if (diff > 200)
                 diff = 200;
+            if (worker_has_readiness (client->worker))
+                diff = 500; // woken when more arrives, just recheck for timeout
             client->schedule_ms = client->worker->time_ms + 6 + diff;
             return 0;
         }
@@ -1190,6 +1192,7 @@ static int http_client_request (client_t *client)
 static void *connection_thread (void *arg)
 {
     ice_config_t *config;
+    client_pools_t pools;
 
 #ifdef HAVE_SIGNALFD
     sigset_t mask;
@@ -1201,6 +1204,9 @@ static void *connection_thread (void *arg)
 #endif
 
     config = config_get_config ();
+    util_set_cpu_affinity (config->connection_cpus, -1);
+    memset (&pools, 0, sizeof (pools));
+    client_pools_attach (&pools);
     /* setup the banned/allowed IP filenames from the xml */
     cached_file_init (&banned_ip,  config->banfile,   add_banned_ip, compare_banned_ip);
     cached_file_init (&allowed_ip, config->allowfile, NULL, NULL);
@@ -1240,6 +1246,7 @@ static void *connection_thread (void *arg)
     cached_file_clear (&useragents);
     global_unlock();
     connection_close_sigfd ();
+    client_pools_detach (&pools);
 
     INFO0 ("connection thread finished");
 
@@ -72,7 +72,7 @@ void event_config_read (void)
         yp_recheck_config (config);
         fserve_recheck_mime_types (config);
         stats_global (config);
-        workers_adjust (config->workers_count);
+        workers_apply_config (config);
         connection_listen_sockets_close (config, 0);
         redirector_setup (config);
         update_relays (config);
@@ -46,35 +46,41 @@ struct flvmeta
 #define FLVHEADER       11
 
 
-static void flv_hdr (struct flv *flv, unsigned int len)
+/* fill in the 4 byte previous tag size and the tag header after it */
+static void flv_tag_fill (unsigned char *tag, unsigned int prev_tagsize, unsigned int len, uint64_t ms)
 {
-    long  v = flv->prev_tagsize;
+    long  v = prev_tagsize;
 
-    v = flv->prev_tagsize;
-    flv->tag [3] = v & 0xFF;
+    tag [3] = v & 0xFF;
     v >>= 8;
-    flv->tag [2] = v & 0xFF;
+    tag [2] = v & 0xFF;
     v >>= 8;
-    flv->tag [1] = v & 0xFF; // assume less than 2^24 
+    tag [1] = v & 0xFF; // assume less than 2^24 
 
     v = (long)len;
-    flv->tag [7] = (unsigned char)(v & 0xFF);
+    tag [7] = (unsigned char)(v & 0xFF);
     v >>= 8;
-    flv->tag [6] = (unsigned char)(v & 0xFF);
+    tag [6] = (unsigned char)(v & 0xFF);
     v >>= 8;
-    flv->tag [5] = (unsigned char)(v & 0xFF);
+    tag [5] = (unsigned char)(v & 0xFF);
 
-    v = (long)flv->prev_ms;
-    flv->tag [10] = (unsigned char)(v & 0xFF);
+    v = (long)ms;
+    tag [10] = (unsigned char)(v & 0xFF);
     v >>= 8;
-    flv->tag [9] = (unsigned char)(v & 0xFF);
+    tag [9] = (unsigned char)(v & 0xFF);
     v >>= 8;
-    flv->tag [8] = (unsigned char)(v & 0xFF);
+    tag [8] = (unsigned char)(v & 0xFF);
     v >>= 8;
-    flv->tag [11] = (unsigned char)(v & 0xFF);
+    tag [11] = (unsigned char)(v & 0xFF);
+}
+
 
+static void flv_hdr (struct flv *flv, unsigned int len)
+{
+    flv_tag_fill (flv->tag, flv->prev_tagsize, len, flv->prev_ms);
 }
 
+
 /* Here we append to the scratch buffer each mp3 type frame. This frame includes the
  * header so with the flv header as well it becomes fairly wasteful but that is what
  * works.
@@ -179,6 +185,114 @@ static int flv_aac_firsthdr (struct mpeg_sync *mp, unsigned char *frame, unsigne
 }
 
 
+/* the FLV tags for the frames of a queue block, built by the first FLV
+ * listener to reach the block and kept with its frame index for the rest.
+ * There is a record per frame of the previous tag size and the tag header.
+ * Timestamps are from the stream position of the block so every listener
+ * can be sent the same tags. NULL if the block cannot be done this way
+ */
+static refbuf_t *flv_block_tags (refbuf_t *block, int aac)
+{
+    refbuf_t *frames = block->frames, *tags;
+    refbuf_frames_t *index;
+    unsigned int i, rec = aac ? 17 : 16, len = 0;
+
+    if (frames == NULL)
+        return NULL;
+    index = (refbuf_frames_t *)frames->data;
+    if (index->whole == 0 || index->samplerate == 0)
+        return NULL;
+    if (frames->associated)
+        return frames->associated;
+
+    tags = refbuf_new (index->count * rec);
+    memset (tags->data, 0, tags->len);
+    for (i = 0; i < index->count; i++)
+    {
+        unsigned char *p = (unsigned char *)block->data + index->frame[i].offset;
+        unsigned char *tag = (unsigned char *)tags->data + i * rec;
+        unsigned int end = (i + 1 < index->count) ? index->frame[i+1].offset : block->len;
+        uint64_t samples = index->start + index->frame[i].samples;
+        unsigned int prev_tagsize = len;
+
+        len = end - index->frame[i].offset;
+        if (aac)
+        {
+            len -= (p[1] & 0x1) ? 7 : 9;    // the adts header is not sent
+            tag[15] = 0xAF;
+            tag[16] = 0x01;
+            len += 2;
+        }
+        else
+        {
+            tag[15] = 0x22;
+            switch (index->samplerate)
+            {
+                case 11025: tag[15] |= (1<<2); break;
+                case 22050: tag[15] |= (2<<2); break;
+                default:    tag[15] |= (3<<2); break;
+            }
+            if (((p[3] & 0xC0) >> 6) != 3)
+                tag[15] |= 0x1;
+            len++;
+        }
+        tag[4] = 8;
+        flv_tag_fill (tag, prev_tagsize, len, (uint64_t)((double)samples / (index->samplerate/1000.0)));
+        len += FLVHEADER;
+    }
+    // the first record's previous tag size is left to each listener
+    if (atomic_cas (&frames->associated, NULL, tags) == 0)
+    {
+        refbuf_release (tags);
+        tags = frames->associated;
+    }
+    return tags;
+}
+
+
+/* queue up the shared tags and frames of the block from the client position.
+ * Only the previous tag size at the start, which depends on what has been
+ * sent before, is written for this listener. -1 if they cannot be used */
+static int flv_shared_frames (client_t *client, struct flv *flv, refbuf_t *ref, int aac)
+{
+    refbuf_t *tags = flv_block_tags (ref, aac), *raw = flv->mpeg_sync.raw;
+    refbuf_frames_t *index;
+    unsigned int i, first, rec = aac ? 17 : 16, len = 0;
+    unsigned char *tag;
+
+    if (tags == NULL)
+        return -1;
+    index = (refbuf_frames_t *)ref->frames->data;
+    for (first = 0; first < index->count && index->frame[first].offset < client->pos; first++)
+        ;
+    if (first == index->count || index->frame[first].offset != client->pos)
+        return -1;
+    if (flv->mpeg_sync.raw_offset + rec > raw->len)
+        return -1;
+
+    tag = (unsigned char *)raw->data + flv->mpeg_sync.raw_offset;
+    memcpy (tag, tags->data + first * rec, rec);
+    tag [3] = flv->prev_tagsize & 0xFF;
+    tag [2] = (flv->prev_tagsize >> 8) & 0xFF;
+    tag [1] = (flv->prev_tagsize >> 16) & 0xFF;
+    flv->mpeg_sync.raw_offset += rec;
+    for (i = first; i < index->count; i++)
+    {
+        unsigned char *p = (unsigned char *)ref->data + index->frame[i].offset;
+        unsigned int end = (i + 1 < index->count) ? index->frame[i+1].offset : ref->len;
+        unsigned int skip = aac ? ((p[1] & 0x1) ? 7 : 9) : 0;
+
+        connection_bufs_append (&flv->bufs, i == first ? tag : (unsigned char *)tags->data + i * rec, rec);
+        len = end - index->frame[i].offset - skip;
+        connection_bufs_append (&flv->bufs, p + skip, len);
+    }
+    flv->prev_tagsize = len + FLVHEADER + (aac ? 2 : 1);
+    flv->samples = index->start + index->samples;
+    flv->prev_ms = (int64_t)((double)flv->samples / (index->samplerate/1000.0));
+    return 0;
+}
+
+
 static int send_flv_buffer (client_t *client, struct flv *flv)
 {
     int ret = 0;
@@ -188,7 +302,7 @@ static int send_flv_buffer (client_t *client, struct flv *flv)
     {
         ret = connection_bufs_send (&client->connection, &flv->bufs, flv->block_pos);
         if (ret < (int)len)
-            client->schedule_ms += 10 + (client->throttle * (ret < 0) ? 15 : 6);
+            client_send_backoff (client, ret);
         if (ret > 0)
             flv->block_pos += ret;
     }
@@ -263,10 +377,7 @@ int flv_write_metadata (struct flv *flv, refbuf_t *scmeta, const char *mount)
         if (meta_copied + 15 + flv->mpeg_sync.raw_offset > raw->len)
         {
             int newlen = meta_copied + flv->mpeg_sync.raw_offset + 1024;
-            void *p = realloc (raw->data, newlen);
-            if (p == NULL) return -1;
-            raw->data = p;
-            raw->len = newlen;
+            if (refbuf_resize (raw, newlen) < 0) return -1;
             flv->block_pos = flv->mpeg_sync.raw_offset = 0;
             connection_bufs_flush (&flv->bufs);
             return -1;
@@ -336,13 +447,40 @@ int write_flv_buf_to_client (client_t *client)
     }
     if (repack)
     {
-        uint64_t prev_samples = flv->samples;
-        int unprocessed = mpeg_complete_frames (&flv->mpeg_sync, ref, client->pos);
+        uint64_t prev_samples;
+        int aac = (flv->mpeg_sync.frame_callback == flv_aac_hdr), shared = 0;
 
-        if (unprocessed < 0)
-            return -1;
-        if (unprocessed > 0 && (ref->flags&REFBUF_SHARED) == 0)
-            ref->len += unprocessed;   /* output was truncated, so revert changes */
+        if (ref->frames)
+        {
+            /* timestamps follow the stream position, as the shared tags do.
+             * That restarts on a source reconnect and differs on a fallback,
+             * so a listener carried across keeps making its own tags */
+            refbuf_frames_t *index = (refbuf_frames_t *)ref->frames->data;
+            uint64_t at;
+            unsigned int i;
+
+            for (i = 0; i < index->count && index->frame[i].offset < client->pos; i++)
+                ;
+            at = index->start + (i < index->count ? index->frame[i].samples : index->samples);
+            if (flv->samples == 0)
+            {
+                flv->samples = at;
+                if (index->samplerate)
+                    flv->prev_ms = (int64_t)((double)flv->samples / (index->samplerate/1000.0));
+            }
+            shared = ((uint64_t)flv->samples == at);
+        }
+        prev_samples = flv->samples;
+        if (shared == 0 || (aac == 0 && flv->mpeg_sync.frame_callback != flv_mpX_hdr) ||
+                flv_shared_frames (client, flv, ref, aac) < 0)
+        {
+            int unprocessed = mpeg_complete_frames (&flv->mpeg_sync, ref, client->pos);
+
+            if (unprocessed < 0)
+                return -1;
+            if (unprocessed > 0 && (ref->flags&REFBUF_SHARED) == 0)
+                ref->len += unprocessed;   /* output was truncated, so revert changes */
+        }
 
         if (flv->seen_metadata != scmeta)
             flv_write_metadata (flv, scmeta, client->mount);
@@ -351,7 +489,7 @@ int write_flv_buf_to_client (client_t *client)
     ret = send_flv_buffer (client, flv);
     if (flv->mpeg_sync.raw_offset == 0)
     {
-        int queue_bytes = client->refbuf->len;
+        int queue_bytes = ref->len - client->pos;
         client->pos = ref->len;
         client->queue_pos += queue_bytes;
         client->counter += queue_bytes;
@@ -154,6 +154,8 @@ int format_file_read (client_t *client, format_plugin_t *plugin, icefile_handle
     do
     {
         len = 8192;
+        if (client_zerocopy_size (client) > len)
+            len = client_zerocopy_size (client) < 65536 ? client_zerocopy_size (client) : 65536;
         if (refbuf == NULL)
         {
             if (file_in_use (f) == 0)
@@ -185,6 +187,14 @@ int format_file_read (client_t *client, format_plugin_t *plugin, icefile_handle
 
         if (file_in_use (f) == 0) return -2;
 
+        if (refbuf->_count > 1 || refbuf->space < len)
+        {
+            // still held by a zero copy send, so read into a new block
+            refbuf_release (refbuf);
+            refbuf = client->refbuf = refbuf_new (len);
+            refbuf->flags |= BUFFER_LOCAL_USE;
+            client->pos = refbuf->len;
+        }
         if (client->flags & CLIENT_RANGE_END)
         {
             if (client->intro_offset >= client->connection.discon.offset)
@@ -239,7 +249,9 @@ int format_generic_write_to_client (client_t *client)
     const char *buf = refbuf->data + client->pos;
     unsigned int len = refbuf->len - client->pos;
 
-    ret = client_send_bytes (client, buf, len);
+    ret = client_send_pinned (client, refbuf, client->pos, len);
+    if (ret == -2)
+        ret = client_send_bytes (client, buf, len);
 
     if (ret > 0)
     {
@@ -66,6 +66,11 @@ struct _format_plugin_tag
     int  (*align_buffer)(client_t *client, format_plugin_t *plugin);
     int  (*get_image)(client_t *client, struct _format_plugin_tag *format);
     void (*swap_client)(client_t *new_cient, client_t *old_client);
+    /* bytes of queued blocks the client can be sent unaltered, 0 if not */
+    unsigned int (*direct_limit)(client_t *client);
+    /* bytes back from a join position at stream pos where the client would
+     * be in step with framing shared between clients, 0 if in step or none */
+    unsigned int (*join_phase)(client_t *client, uint64_t pos);
 
     /* for internal state management */
     void *_state;
@@ -59,6 +59,8 @@ static int  format_mp3_create_client_data (format_plugin_t *plugin, client_t *cl
 static void free_mp3_client_data (client_t *client);
 static int  format_mp3_write_buf_to_client(client_t *client);
 static int  write_mpeg_buf_to_client (client_t *client);
+static unsigned int mpeg_direct_limit (client_t *client);
+static unsigned int mpeg_join_phase (client_t *client, uint64_t pos);
 static void write_mp3_to_file (struct source_tag *source, refbuf_t *refbuf);
 static void mp3_set_tag (format_plugin_t *plugin, const char *tag, const char *in_value, const char *charset);
 static void format_mp3_apply_settings (format_plugin_t *format, mount_proxy *mount);
@@ -74,6 +76,15 @@ static void mpeg_apply_client (format_plugin_t *plugin, client_t *client);
 
 static refbuf_t blank_meta = { 0, 1, NULL, NULL, "\001StreamTitle='';", 17 };
 
+/* most iovec entries used for one send of blocks and metadata inserts */
+#define ICY_ALIGNED_VECS                16
+
+/* most queue blocks sent together to a chunked listener */
+#define CHUNKED_SEND_BLOCKS             8
+
+/* usual size of the slabs read into and carved up for queue blocks */
+#define MP3_SLAB_SIZE                   65536
+
 
 int format_mp3_get_plugin (format_plugin_t *plugin)
 {
@@ -81,6 +92,8 @@ int format_mp3_get_plugin (format_plugin_t *plugin)
 
     plugin->get_buffer = mp3_get_no_meta;
     plugin->write_buf_to_client = write_mpeg_buf_to_client;
+    plugin->direct_limit = mpeg_direct_limit;
+    plugin->join_phase = mpeg_join_phase;
     plugin->write_buf_to_file = write_mp3_to_file;
     plugin->create_client_data = format_mp3_create_client_data;
     plugin->free_plugin = format_mp3_free_plugin;
@@ -113,6 +126,10 @@ static void mpeg_apply_client (format_plugin_t *plugin, client_t *client)
     refbuf_release (source_mp3->read_data);
     source_mp3->read_data = NULL;
     source_mp3->read_count = 0;
+    refbuf_release (source_mp3->slab);
+    source_mp3->slab = NULL;
+    source_mp3->slab_start = source_mp3->slab_fill = 0;
+    source_mp3->slab_want = source_mp3->slab_unprocessed = 0;
     free (plugin->contenttype);
     plugin->contenttype = NULL;
 
@@ -157,6 +174,7 @@ static void mpeg_apply_client (format_plugin_t *plugin, client_t *client)
         if (client->format_data == NULL)
             client->format_data = malloc (sizeof (mpeg_sync));
         mpeg_setup (client->format_data, client->connection.ip);
+        mpeg_set_flags (client->format_data, 1<<9);  // index frames for bursts
         plugin->write_buf_to_client = write_mpeg_buf_to_client;
     }
     source_mp3->read_data = refbuf_new (8000);
@@ -581,12 +599,210 @@ static int send_icy_metadata (client_t *client, refbuf_t *refbuf)
             client->flags |= CLIENT_IN_METADATA;
             client_mp3->metadata_offset += ret;
         }
-        client->schedule_ms += 10 + (client->throttle * (ret < 0) ? 15 : 6);
+        client_send_backoff (client, ret);
+    }
+    return ret;
+}
+
+
+/* Shoutcast style metadata is inserted at stream positions that are a
+ * multiple of the interval, so every listener of a mount using the same
+ * interval has the inserts at the same places in the queue. A listener in
+ * step with those positions has a run of blocks sent along with the inserts
+ * between them in one writev, the inserts being the same for each listener
+ * apart from the nul byte for unchanged metadata.
+ */
+static int send_icy_aligned (client_t *client)
+{
+    mp3_client_data *client_mp3 = client->format_data;
+    refbuf_t *refbuf = client->refbuf, *associated = client_mp3->associated;
+    refbuf_t *inserts [ICY_ALIGNED_VECS];
+    unsigned int pos = client->pos, since = client_mp3->since_meta_block, total = 0;
+    struct connection_bufs bufs;
+    int ret, count = 0, segments = 0, i;
+
+    connection_bufs_init (&bufs, ICY_ALIGNED_VECS);
+    while (count < ICY_ALIGNED_VECS && total < client_mp3->max_send_size)
+    {
+        unsigned int len;
+
+        if (pos >= refbuf->len)
+        {
+            if (refbuf->next == NULL)
+                break;
+            refbuf = refbuf->next;
+            pos = 0;
+        }
+        if (since == client_mp3->interval)
+        {
+            refbuf_t *meta = refbuf->associated ? refbuf->associated : &blank_meta;
+
+            if (meta == associated)
+                connection_bufs_append (&bufs, "\0", 1);  // unchanged since the last insert
+            else
+                connection_bufs_append (&bufs, meta->data, meta->len);
+            inserts [count++] = associated = meta;
+            since = 0;
+            continue;
+        }
+        len = refbuf->len - pos;
+        if (len > client_mp3->interval - since)
+            len = client_mp3->interval - since;
+        if (len > client_mp3->max_send_size - total)
+            len = client_mp3->max_send_size - total;
+        connection_bufs_append (&bufs, refbuf->data + pos, len);
+        inserts [count++] = NULL;
+        segments++;
+        pos += len;
+        since += len;
+        total += len;
+    }
+    ret = connection_bufs_send (&client->connection, &bufs, 0);
+    if (ret > 0)
+        client_gathered_send (client, segments);
+
+    /* apply what was written in the same order as it was gathered */
+    for (i = 0, total = ret > 0 ? ret : 0; i < count && total; i++)
+    {
+        unsigned int part = IO_VECTOR_LEN (bufs.block + i);
+
+        if (inserts [i])
+        {
+            if (total < part)
+            {
+                /* finished by send_icy_metadata */
+                client->flags |= CLIENT_IN_METADATA;
+                client_mp3->metadata_offset = total;
+                if (inserts [i] == &blank_meta)
+                    client_mp3->associated = &blank_meta;
+                break;
+            }
+            client_mp3->associated = inserts [i];
+            client_mp3->since_meta_block = 0;
+            total -= part;
+            continue;
+        }
+        if (client->pos >= client->refbuf->len)
+        {
+            client->refbuf = client->refbuf->next;
+            client->pos = 0;
+        }
+        if (part > total)
+            part = total;
+        client->pos += part;
+        client->queue_pos += part;
+        client->counter += part;
+        client_mp3->since_meta_block += part;
+        total -= part;
     }
+    if (ret < (int)bufs.total)
+        client_send_backoff (client, ret);
+    connection_bufs_release (&bufs);
     return ret;
 }
 
 
+/* Chunked listeners are sent queue blocks whole, so the chunk framing of a
+ * block is the same for all of them. The first chunked listener to reach a
+ * block writes the trailer and the header for it, either into the space after
+ * the block data or, for a block carved from a slab, into the space the block
+ * keeps for itself. Returns where the framing is, or NULL if the block cannot
+ * be framed that way.
+ */
+static char *mpeg_chunk_framing (refbuf_t *refbuf, unsigned int *hdrlen)
+{
+    unsigned int flags = atomic_load_acquire (&refbuf->flags), room = 0, v;
+    char *frame = NULL;
+
+    for (*hdrlen = 3, v = refbuf->len; v > 15; v >>= 4)
+        (*hdrlen)++;
+    if (refbuf->data == (char *)(refbuf + 1))
+    {
+        frame = refbuf->data + refbuf->len;
+        room = refbuf->space - refbuf->len;
+    }
+    else if (refbuf->slab)
+    {
+        frame = (char *)(refbuf + 1);
+        room = refbuf->space;
+    }
+    if (flags & SOURCE_BLOCK_CHUNKED)
+        return frame;
+    if ((flags & SOURCE_BLOCK_CHUNKING) || refbuf->len == 0 || room <= *hdrlen + 2)
+        return NULL;
+    if (atomic_cas (&refbuf->flags, flags, flags | SOURCE_BLOCK_CHUNKING) == 0)
+        return NULL;    // another listener is framing it
+    snprintf (frame, room, "\r\n%x\r\n", refbuf->len);
+    // the framing is written before other listeners can see it as done
+    atomic_store_release (&refbuf->flags, flags | SOURCE_BLOCK_CHUNKING | SOURCE_BLOCK_CHUNKED);
+    return frame;
+}
+
+
+/* send a run of queue blocks, with their shared chunk framing, to a chunked
+ * listener. The connection chunk_pos is the offset into the first block's
+ * framed chunk. Returns -2 if the blocks need framing for this client alone.
+ */
+static int send_chunked_blocks (client_t *client)
+{
+    mp3_client_data *client_mp3 = client->format_data;
+    refbuf_t *refbuf = client->refbuf;
+    struct connection_bufs bufs;
+    unsigned int hdrlen, total = 0, done, framed [CHUNKED_SEND_BLOCKS];
+    int ret, count = 0, i, written = 0, skip = client->connection.chunk_pos;
+    char *frame;
+
+    connection_bufs_init (&bufs, CHUNKED_SEND_BLOCKS * 3);
+    while (refbuf && count < CHUNKED_SEND_BLOCKS && total < client_mp3->max_send_size)
+    {
+        if (total + refbuf->len > client_mp3->max_send_size && count)
+            break;
+        if (refbuf->len > client_mp3->max_send_size || (frame = mpeg_chunk_framing (refbuf, &hdrlen)) == NULL)
+            break;
+        connection_bufs_append (&bufs, frame + 2, hdrlen);
+        if (frame == refbuf->data + refbuf->len)
+            connection_bufs_append (&bufs, refbuf->data, refbuf->len + 2);
+        else
+        {
+            connection_bufs_append (&bufs, refbuf->data, refbuf->len);
+            connection_bufs_append (&bufs, frame, 2);
+        }
+        framed [count++] = hdrlen + refbuf->len + 2;
+        total += refbuf->len;
+        refbuf = refbuf->next;
+    }
+    if (count == 0)
+    {
+        connection_bufs_release (&bufs);
+        return -2;
+    }
+    ret = connection_bufs_send (&client->connection, &bufs, skip);
+    if (ret > 0)
+    {
+        client_gathered_send (client, count);
+        done = skip + ret;
+        for (i = 0; i < count; i++)
+        {
+            if (done < framed [i])
+                break;
+            done -= framed [i];
+            written += client->refbuf->len;
+            client->queue_pos += client->refbuf->len;
+            client->counter += client->refbuf->len;
+            if (i + 1 < count)
+                client->refbuf = client->refbuf->next;
+            else
+                client->pos = client->refbuf->len;
+        }
+        client->connection.chunk_pos = done;
+    }
+    if (ret < (int)bufs.total - skip)
+        client_send_backoff (client, ret);
+    connection_bufs_release (&bufs);
+    return written ? written : -1;
+}
+
+
 /* Handler for writing mp3 data to a client, taking into account whether
  * client has requested shoutcast style metadata updates
  */
@@ -596,9 +812,24 @@ static int format_mp3_write_buf_to_client (client_t *client)
     mp3_client_data *client_mp3 = client->format_data;
     refbuf_t *refbuf = client->refbuf;
 
+    if (client_mp3->interval && (refbuf->flags & SOURCE_QUEUE_BLOCK) &&
+            (client->flags & (CLIENT_CHUNKED|CLIENT_IN_METADATA|CLIENT_HAS_INTRO_CONTENT)) == 0)
+    {
+        unsigned int phase = (client->queue_pos + client_mp3->interval - client_mp3->since_meta_block) % client_mp3->interval;
+
+        // a listener out of step keeps its own insert positions below
+        if (phase == 0)
+            return send_icy_aligned (client);
+    }
     if (client_mp3->interval && client_mp3->interval == client_mp3->since_meta_block)
         return send_icy_metadata (client, refbuf);
 
+    if ((client->flags & CLIENT_CHUNKED) && client->pos == 0 && (refbuf->flags & SOURCE_QUEUE_BLOCK))
+    {
+        ret = send_chunked_blocks (client);
+        if (ret != -2)
+            return ret;
+    }
     len = refbuf->len - client->pos;
     if (client_mp3->interval && len > client_mp3->interval - client_mp3->since_meta_block)
         len = client_mp3->interval - client_mp3->since_meta_block;
@@ -641,7 +872,7 @@ static int format_mp3_write_buf_to_client (client_t *client)
             ret = client_send_bytes (client, buf, len);
 
         if (ret < len)
-            client->schedule_ms += 10 + (client->throttle * (ret < 0) ? 15 : 6);
+            client_send_backoff (client, ret);
         if (ret > 0)
         {
             client_mp3->since_meta_block += ret;
@@ -656,7 +887,7 @@ static int format_mp3_write_buf_to_client (client_t *client)
 
 static int send_iceblock_to_client (client_t *client) 
 {
-    int ret = -1, len = 0, skip = 0;
+    int ret = -1, len = 0;
     mp3_client_data *client_mpg = client->format_data;
     refbuf_t *refbuf = client->refbuf;
     unsigned char lengthbytes[2];
@@ -674,31 +905,28 @@ static int send_iceblock_to_client (client_t *client)
             connection_bufs_append (&v, meta->data+off, meta->len-off);
         }
     }
-    skip = connection_bufs_append (&v, lengthbytes, 2);
-    len = connection_bufs_append (&v, refbuf->data, refbuf->len);
+    // a listener may join part way into a block, at a frame
+    connection_bufs_append (&v, lengthbytes, 2);
+    len = connection_bufs_append (&v, refbuf->data + client->pos, refbuf->len - client->pos);
 
-    lengthbytes[0] = ((refbuf->len+2) >> 8) & 0x7F;
-    lengthbytes[1] = (refbuf->len+2) & 0xFF;
+    lengthbytes[0] = ((refbuf->len - client->pos + 2) >> 8) & 0x7F;
+    lengthbytes[1] = (refbuf->len - client->pos + 2) & 0xFF;
     ret = connection_bufs_send (&client->connection, &v, client_mpg->metadata_offset);
     connection_bufs_release (&v);
 
     if (ret > 0)
-    {
-        client->queue_pos += ret;
-        if (client_mpg->metadata_offset < skip)
-            client->queue_pos -= (skip - client_mpg->metadata_offset);
         client_mpg->metadata_offset += ret;
-    }
 
     if (client_mpg->metadata_offset >= len)
     {
+        client->queue_pos += refbuf->len - client->pos;   // stream bytes only, not the framing
         client->pos = refbuf->len;
         if (refbuf->associated != client_mpg->associated)
             client_mpg->associated = refbuf->associated;
         client_mpg->metadata_offset = 0;
     }
     if (ret < len)
-        client->schedule_ms += 10 + (client->throttle * (ret < 0) ? 15 : 6);
+        client_send_backoff (client, ret);
     return ret;
 }
 
@@ -715,6 +943,34 @@ static int write_mpeg_buf_to_client (client_t *client)
 }
 
 
+/* without inserted metadata or framing the client is sent the blocks as is */
+static unsigned int mpeg_direct_limit (client_t *client)
+{
+    mp3_client_data *client_mp3 = client->format_data;
+
+    if (client->flags & (CLIENT_WANTS_META|CLIENT_WANTS_FLV|CLIENT_CHUNKED))
+        return 0;
+    if (client_mp3 == NULL)
+        return 65536;
+    if (client_mp3->interval)
+        return 0;
+    return client_mp3->max_send_size;
+}
+
+
+/* icy listeners joining on a multiple of the interval have their inserts at
+ * the shared positions, so can be sent with send_icy_aligned */
+static unsigned int mpeg_join_phase (client_t *client, uint64_t pos)
+{
+    mp3_client_data *client_mp3 = client->format_data;
+
+    if (client_mp3 == NULL || client_mp3->interval == 0 ||
+            (client->flags & (CLIENT_WANTS_META|CLIENT_WANTS_FLV|CLIENT_CHUNKED|CLIENT_IN_METADATA)))
+        return 0;
+    return (pos + client_mp3->interval - client_mp3->since_meta_block) % client_mp3->interval;
+}
+
+
 static void format_mp3_free_plugin (format_plugin_t *plugin, client_t *client)
 {
     /* free the plugin instance */
@@ -733,6 +989,7 @@ static void format_mp3_free_plugin (format_plugin_t *plugin, client_t *client)
     free (format_mp3->extra_icy_meta);
     refbuf_release (format_mp3->metadata);
     refbuf_release (format_mp3->read_data);
+    refbuf_release (format_mp3->slab);
     free (format_mp3);
 }
 
@@ -881,6 +1138,13 @@ static int validate_mpeg (source_t *source, refbuf_t *refbuf)
             WARN3 ("source %s, len %ld, unprocessed %d", source->mount, (long)len, unprocessed);
             len = unprocessed + 1000;
         }
+        if (refbuf->slab)
+        {
+            // left in the slab to start the next block
+            source_mp3->slab_unprocessed = unprocessed;
+            source_mp3->slab_want = len;
+            return refbuf->len ? 0 : -1;
+        }
         leftover = refbuf_new (len);
         memcpy (leftover->data, refbuf->data + refbuf->len, unprocessed);
         source_mp3->read_data = leftover;
@@ -891,22 +1155,96 @@ static int validate_mpeg (source_t *source, refbuf_t *refbuf)
 }
 
 
-/* read an mp3 stream which does not have shoutcast style metadata */
+/* read as much as there is room for into the slab, which queue blocks are
+ * carved from. The remains of a slab are moved to a new one once there is
+ * not enough room left for another block. Returns 1 once there is enough for
+ * the next block.
+ */
+static int slab_read (source_t *source)
+{
+    format_plugin_t *format = source->format;
+    mp3_state *source_mp3 = format->_state;
+    client_t *client = source->client;
+    refbuf_t *slab = source_mp3->slab;
+    unsigned int want = source_mp3->slab_want ? source_mp3->slab_want : source_mp3->qblock_sz;
+    int bytes;
+
+    if (source_mp3->update_metadata)
+    {
+        mp3_set_title (source);
+        source_mp3->update_metadata = 0;
+    }
+    if (source_mp3->slab_fill - source_mp3->slab_start >= want)
+        return 1;
+    if (slab == NULL || slab->space - source_mp3->slab_start < want)
+    {
+        unsigned int held = source_mp3->slab_fill - source_mp3->slab_start;
+
+        source_mp3->slab = refbuf_new (want * 2 > MP3_SLAB_SIZE ? want * 2 : MP3_SLAB_SIZE);
+        if (held)
+            memcpy (source_mp3->slab->data, slab->data + source_mp3->slab_start, held);
+        refbuf_release (slab);
+        slab = source_mp3->slab;
+        source_mp3->slab_start = 0;
+        source_mp3->slab_fill = held;
+    }
+    bytes = client_read_bytes (client, slab->data + source_mp3->slab_fill, slab->space - source_mp3->slab_fill);
+    if (bytes > 0)
+    {
+        rate_add (source->in_bitrate, bytes, client->worker->current_time.tv_sec);
+        source_mp3->slab_fill += bytes;
+        format->read_bytes += bytes;
+    }
+    if (source_mp3->slab_fill - source_mp3->slab_start < want)
+    {
+        // increase retry delay on small read, to reduce rescheduling
+        if (bytes > 0 && want - (source_mp3->slab_fill - source_mp3->slab_start) > 700)
+            client->schedule_ms += 10;
+        return 0;
+    }
+    if (source->incoming_rate && source->incoming_rate < 65536)
+        client->schedule_ms += (65536/source->incoming_rate);
+    else
+        client->schedule_ms += 1;
+    return 1;
+}
+
+
+/* read an mp3 stream which does not have shoutcast style metadata, the
+ * blocks queued are carved from the slab read into, so the data is neither
+ * copied nor allocated per block.
+ */
 static refbuf_t *mp3_get_no_meta (source_t *source)
 {
-    refbuf_t *refbuf;
+    refbuf_t *refbuf, *slab;
     mp3_state *source_mp3 = source->format->_state;
     client_t *client = source->client;  // maybe move mp3_state into client instead of plugin?
+    unsigned int want, kept;
+    int ret = 0;
 
-    if (complete_read (source) == 0)
+    if (slab_read (source) == 0)
         return NULL;
 
-    refbuf = source_mp3->read_data;
-    refbuf->len = source_mp3->read_count;
-    source_mp3->read_count = 0;
-    source_mp3->read_data = NULL;
+    slab = source_mp3->slab;
+    want = source_mp3->slab_want ? source_mp3->slab_want : source_mp3->qblock_sz;
+    refbuf = refbuf_carve (slab, slab->data + source_mp3->slab_start, want);
+    source_mp3->slab_want = source_mp3->slab_unprocessed = 0;
 
-    if (client->format_data && validate_mpeg (source, refbuf) < 0)
+    if (client->format_data)
+        ret = validate_mpeg (source, refbuf);
+
+    /* a partial frame is left in place for the next block, any bytes dropped
+     * while finding frame sync are closed up */
+    kept = refbuf->len + source_mp3->slab_unprocessed;
+    if (kept < want)
+    {
+        char *end = slab->data + source_mp3->slab_start + want;
+
+        memmove (end - (want - kept), end, slab->data + source_mp3->slab_fill - end);
+        source_mp3->slab_fill -= want - kept;
+    }
+    source_mp3->slab_start += refbuf->len;
+    if (ret < 0)
     {
         refbuf_release (refbuf);
         return NULL;
@@ -51,6 +51,12 @@ typedef struct {
     refbuf_t *metadata;
     refbuf_t *read_data;
     int read_count;
+
+    /* queue blocks are carved from a larger slab when there is no inline
+     * metadata to filter out */
+    refbuf_t *slab;
+    unsigned int slab_start, slab_fill;
+    unsigned int slab_want, slab_unprocessed;
     unsigned short req_qblock_sz;
     unsigned short qblock_sz;
     unsigned short max_send_size;
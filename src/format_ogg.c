@@ -50,6 +50,9 @@
 #define CATMODULE "format-ogg"
 #include "logging.h"
 
+/* usual size of the slabs read into, pages are queued straight from them */
+#define OGG_SLAB_SIZE   65536
+
 struct _ogg_state_tag;
 
 static void format_ogg_free_plugin (format_plugin_t *plugin, client_t *client);
@@ -73,13 +76,9 @@ struct ogg_client
 };
 
 
-refbuf_t *make_refbuf_with_page (ogg_codec_t *codec, ogg_page *page)
+static refbuf_t *copy_page (ogg_page *page)
 {
-    refbuf_t *refbuf;
-
-    if (codec && codec->filtered)
-        return NULL;
-    refbuf = refbuf_new (page->header_len + page->body_len);
+    refbuf_t *refbuf = refbuf_new (page->header_len + page->body_len);
 
     memcpy (refbuf->data, page->header, page->header_len);
     memcpy (refbuf->data+page->header_len, page->body, page->body_len);
@@ -87,6 +86,25 @@ refbuf_t *make_refbuf_with_page (ogg_codec_t *codec, ogg_page *page)
 }
 
 
+/* make a queue block of the page. Pages found by the scanner lie whole
+ * within the read slab so the block just refers to them there, anything
+ * else (eg pages rebuilt by libogg) has to be copied.
+ */
+refbuf_t *make_refbuf_with_page (ogg_codec_t *codec, ogg_page *page)
+{
+    refbuf_t *slab;
+
+    if (codec && codec->filtered)
+        return NULL;
+    slab = codec ? codec->parent->slab : NULL;
+    if (slab && (char*)page->header >= slab->data &&
+            page->body == page->header + page->header_len &&
+            (char*)page->body + page->body_len <= slab->data + codec->parent->slab_fill)
+        return refbuf_carve (slab, (char*)page->header, page->header_len + page->body_len);
+    return copy_page (page);
+}
+
+
 /* routine for taking the provided page (should be a header page) and
  * placing it on the collection of header pages
  */
@@ -98,7 +116,9 @@ void format_ogg_attach_header (ogg_codec_t *codec, ogg_page *page)
     if (codec->filtered)
         return;
 
-    refbuf = make_refbuf_with_page (codec, page);
+    /* header pages are kept for the life of the stream, so do not let
+     * them hold on to the slab */
+    refbuf = copy_page (page);
 
     if (ogg_page_bos (page))
     {
@@ -182,7 +202,9 @@ static void ogg_apply_client (format_plugin_t *plugin, client_t *client)
     ogg_state_t *state = plugin->_state;
 
     state->mount = NULL;
-    ogg_sync_clear (&state->oy);
+    refbuf_release (state->slab);
+    state->slab = NULL;
+    state->slab_start = state->slab_fill = 0;
 
     if (client == NULL)
         return;
@@ -197,8 +219,6 @@ static void ogg_apply_client (format_plugin_t *plugin, client_t *client)
             plugin->contenttype = strdup (s);
     }
 
-    ogg_sync_init (&state->oy);
-
     state->mount = plugin->mount;
     state->bos_end = &state->header_pages;
 }
@@ -213,7 +233,7 @@ static void format_ogg_free_plugin (format_plugin_t *plugin, client_t *client)
     free (state->artist);
     free (state->title);
 
-    ogg_sync_clear (&state->oy);
+    refbuf_release (state->slab);
     free (state);
 }
 
@@ -423,6 +443,109 @@ static refbuf_t *process_ogg_page (ogg_state_t *ogg_info, ogg_page *page)
 }
 
 
+/* Ogg page CRC, polynomial 0x04c11db7 worked a nibble at a time */
+static const ogg_uint32_t ogg_crc_nibble [16] =
+{
+    0x00000000, 0x04c11db7, 0x09823b6e, 0x0d4326d9,
+    0x130476dc, 0x17c56b6b, 0x1a864db2, 0x1e475005,
+    0x2608edb8, 0x22c9f00f, 0x2f8ad6d6, 0x2b4bcb61,
+    0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd
+};
+
+static ogg_uint32_t ogg_crc_update (ogg_uint32_t crc, const unsigned char *p, unsigned int len)
+{
+    while (len--)
+    {
+        crc ^= (ogg_uint32_t)*p++ << 24;
+        crc = (crc << 4) ^ ogg_crc_nibble [crc >> 28];
+        crc = (crc << 4) ^ ogg_crc_nibble [crc >> 28];
+    }
+    return crc;
+}
+
+
+/* look for the next whole page in the slab. The page is set to refer to
+ * the data where it lies so no copy is made. Anything that is not a page
+ * with a valid CRC is skipped. Returns 0 if more data is needed.
+ */
+static int ogg_page_scan (ogg_state_t *ogg_info, ogg_page *page)
+{
+    static const unsigned char crc_field [4];
+    refbuf_t *slab = ogg_info->slab;
+
+    if (slab == NULL)
+        return 0;
+    while (1)
+    {
+        unsigned char *p = (unsigned char *)slab->data + ogg_info->slab_start;
+        unsigned int avail = ogg_info->slab_fill - ogg_info->slab_start;
+        unsigned int header_len, body_len = 0, i;
+        ogg_uint32_t crc;
+
+        if (avail < 27)
+            return 0;
+        if (memcmp (p, "OggS", 4) == 0 && p[4] == 0)
+        {
+            header_len = 27 + p[26];
+            if (avail < header_len)
+                return 0;
+            for (i = 27; i < header_len; i++)
+                body_len += p[i];
+            if (avail < header_len + body_len)
+                return 0;
+            // the CRC is worked out with its own field as zeros
+            crc = ogg_crc_update (0, p, 22);
+            crc = ogg_crc_update (crc, crc_field, 4);
+            crc = ogg_crc_update (crc, p + 26, header_len + body_len - 26);
+            if (crc == (p[22] | (p[23] << 8) | (p[24] << 16) | ((ogg_uint32_t)p[25] << 24)))
+            {
+                page->header = p;
+                page->header_len = header_len;
+                page->body = p + header_len;
+                page->body_len = body_len;
+                ogg_info->slab_start += header_len + body_len;
+                return 1;
+            }
+        }
+        /* lost sync, skip to the next possible capture pattern */
+        p = memchr (p + 1, 'O', avail - 1);
+        if (p)
+            ogg_info->slab_start = (char*)p - slab->data;
+        else
+            ogg_info->slab_start = ogg_info->slab_fill;
+    }
+}
+
+
+/* read as much as there is room for into the slab. Any partial page left
+ * at the end is moved to a new slab once there is too little room left
+ * to be worth reading into, pages already queued keep the old one.
+ */
+static int ogg_slab_read (source_t *source)
+{
+    ogg_state_t *ogg_info = source->format->_state;
+    refbuf_t *slab = ogg_info->slab;
+    int bytes;
+
+    if (slab == NULL || slab->space - ogg_info->slab_fill < 4096)
+    {
+        unsigned int held = slab ? ogg_info->slab_fill - ogg_info->slab_start : 0;
+
+        ogg_info->slab = refbuf_new (held + OGG_SLAB_SIZE);
+        if (held)
+            memcpy (ogg_info->slab->data, slab->data + ogg_info->slab_start, held);
+        refbuf_release (slab);
+        slab = ogg_info->slab;
+        ogg_info->slab_start = 0;
+        ogg_info->slab_fill = held;
+    }
+    bytes = client_read_bytes (source->client, slab->data + ogg_info->slab_fill, slab->space - ogg_info->slab_fill);
+    if (bytes > 0)
+        ogg_info->slab_fill += bytes;
+    return bytes;
+}
+
+
 /* main plugin handler for getting a buffer for the queue. In here we
  * just add an incoming page to the codecs and process it until either
  * more data is needed or we prodice a buffer for the queue.
@@ -431,7 +554,6 @@ static refbuf_t *ogg_get_buffer (source_t *source)
 {
     ogg_state_t *ogg_info = source->format->_state;
     format_plugin_t *format = source->format;
-    char *data = NULL;
     int bytes = 0, total = 0;
 
     while (total < 15000)
@@ -452,7 +574,7 @@ static refbuf_t *ogg_get_buffer (source_t *source)
                 ogg_info->current = NULL;
             }
 
-            if (ogg_sync_pageout (&ogg_info->oy, &page) > 0)
+            if (ogg_page_scan (ogg_info, &page))
             {
                 if (ogg_page_bos (&page))
                 {
@@ -477,19 +599,15 @@ static refbuf_t *ogg_get_buffer (source_t *source)
             break;
         }
         /* we need more data to continue getting pages */
-        data = ogg_sync_buffer (&ogg_info->oy, 4096);
-
-        bytes = client_read_bytes (source->client, data, 4096);
+        bytes = ogg_slab_read (source);
         if (bytes <= 0)
         {
-            ogg_sync_wrote (&ogg_info->oy, 0);
             source->client->schedule_ms += 50;
             break;
         }
         total += bytes;
         format->read_bytes += bytes;
         rate_add (source->in_bitrate, bytes, source->client->worker->current_time.tv_sec);
-        ogg_sync_wrote (&ogg_info->oy, bytes);
     }
     return NULL;
 }
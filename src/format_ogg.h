@@ -25,7 +25,9 @@
 typedef struct ogg_state_tag
 {
     char *mount;
-    ogg_sync_state oy;
+    refbuf_t *slab;             /* read into, pages are queued from here */
+    unsigned int slab_start;    /* start of the next page to scan for */
+    unsigned int slab_fill;
     int error;
 
     int codec_count;
@@ -642,14 +642,16 @@ static void file_release (client_t *client)
 struct _client_functions buffer_content_ops =
 {
     prefile_send,
-    file_release
+    file_release,
+    CLIENT_OPS_FSERVE
 };
 
 
 struct _client_functions file_content_ops =
 {
     file_send,
-    file_release
+    file_release,
+    CLIENT_OPS_FSERVE
 };
 
 
@@ -688,20 +690,15 @@ static int fserve_change_worker (client_t *client)
     worker_t *this_worker = client->worker, *worker;
     int ret = 0;
 
-    if (this_worker->move_allocations == 0 || worker_count < 2)
+    if (this_worker->steal_to == NULL || worker_count < 2)
         return 0;
     thread_rwlock_rlock (&workers_lock);
-    worker = worker_selected ();
-    if (worker && worker != client->worker)
+    worker = worker_steal_dest (this_worker, 1);
+    if (worker)
     {
-        long diff = this_worker->count - worker->count;
-        if (diff > 15)
-        {
-            this_worker->move_allocations--;
-            ret = client_change_worker (client, worker);
-            if (ret)
-                DEBUG2 ("moving listener from %p to %p", this_worker, worker);
-        }
+        ret = client_change_worker (client, worker);
+        if (ret)
+            DEBUG2 ("moving listener from %p to %p", this_worker, worker);
     }
     thread_rwlock_unlock (&workers_lock);
     return ret;
@@ -886,7 +883,8 @@ static int throttled_file_send (client_t *client)
 struct _client_functions throttled_file_content_ops =
 {
     throttled_file_send,
-    file_release
+    file_release,
+    CLIENT_OPS_FSERVE
 };
 
 
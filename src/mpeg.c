@@ -21,6 +21,7 @@
 
 #include "compat.h"
 #include "mpeg.h"
+#include "mpeg_scan.h"
 #include "format_mp3.h"
 #include "global.h"
 
@@ -43,6 +44,7 @@ int mpeg_samplerates [4][4] = {
 
 //  settings is a bitmask
 //  bit 15         skip processing
+//  bit 9          index the frames of each block
 //  bit 8          allow trailing tags, eg from file
 //  bit 7          settings changed
 //  bit 6, 5, 4    channels
@@ -488,7 +490,7 @@ static int get_initial_frame (struct mpeg_sync *mp, unsigned char *p, unsigned r
         return 2; // we should skip processing
 
     // reset all but external options
-    mp->settings = mp->settings & (1<<8);
+    mp->settings = mp->settings & (3<<8);
 
     if (p[0] == 'I' || p[0] == 'T' || p[0] == 'A')
        ret = check_for_id3 (mp, p, remaining);
@@ -571,7 +573,16 @@ static int find_align_sync (mpeg_sync *mp, unsigned char *start, int remaining,
         {
             int offset = remaining;
             do {
+                unsigned char *c;
                 if (offset < 3) break;
+                c = find_sync_candidate (p, offset - 2);
+                if (c == NULL)
+                {
+                    p += offset - 2;
+                    break;
+                }
+                offset -= c - p;
+                p = c;
                 if (*p == 0x47) break;
                 if (*p == 0xFF)
                     if (p[1] != 0xFF || p[2] <= 0xFB) break;
@@ -597,10 +608,34 @@ static int find_align_sync (mpeg_sync *mp, unsigned char *start, int remaining,
 }
 
 
+/* attach the index of the frames found to the block */
+static void mpeg_index_block (mpeg_sync *mp, refbuf_t *block, unsigned int found[][2], unsigned int count, unsigned int samples, int whole)
+{
+    refbuf_t *frames = refbuf_new (sizeof (refbuf_frames_t) + count * sizeof (found[0]));
+    refbuf_frames_t *index = (refbuf_frames_t *)frames->data;
+    unsigned int i;
+
+    index->start = 0;
+    index->samplerate = mp->samplerate;
+    index->samples = samples;
+    index->count = count;
+    index->whole = whole;
+    for (i = 0; i < count; i++)
+    {
+        index->frame[i].offset = found[i][0];
+        index->frame[i].samples = found[i][1];
+    }
+    refbuf_release (block->frames);
+    block->frames = frames;
+}
+
+
 int mpeg_complete_frames (mpeg_sync *mp, refbuf_t *new_block, unsigned offset)
 {
     unsigned char *start, *end;
     int remaining, frame_len = 0, ret, loop = 50;
+    unsigned int found [MPEG_INDEX_FRAMES][2], indexed = 0, samples = 0, expect = offset;
+    int whole = 1;
 
     if (mp == NULL || (mp->settings & 0x8000))
         return 0;  /* leave as-is */
@@ -623,13 +658,15 @@ int mpeg_complete_frames (mpeg_sync *mp, refbuf_t *new_block, unsigned offset)
             offset -= mp->surplus->len;
         else
         {
-            int new_len = mp->surplus->len + new_block->len;
-            unsigned char *p = realloc (mp->surplus->data, new_len);
+            unsigned int len = new_block->len;
 
-            memcpy (p+mp->surplus->len, new_block->data, new_block->len);
-            mp->surplus->data = new_block->data;
-            new_block->data = (void*)p;
-            new_block->len = new_len;
+            if (refbuf_resize (new_block, mp->surplus->len + len) == 0)
+            {
+                memmove (new_block->data + mp->surplus->len, new_block->data, len);
+                memcpy (new_block->data, mp->surplus->data, mp->surplus->len);
+            }
+            else
+                offset = 0;
         }
         refbuf_release (mp->surplus);
         mp->surplus = NULL;
@@ -644,11 +681,28 @@ int mpeg_complete_frames (mpeg_sync *mp, refbuf_t *new_block, unsigned offset)
             break;
         if (mp->mask && match_syncbits (mp, start) == 0) 
         {
+            mp->sample_count = 0;
             frame_len = mp->process_frame (mp, start, remaining);
             if (frame_len == 0)
                 break;
             if (frame_len > 0)
             {
+                if (mp->settings & (1<<9))
+                {
+                    unsigned int at = start - (unsigned char *)new_block->data;
+
+                    // whole if only audio frames, back to back, are in the block
+                    if (at != expect || mp->sample_count == 0 || indexed == MPEG_INDEX_FRAMES)
+                        whole = 0;
+                    expect = at + frame_len;
+                    if (mp->sample_count && indexed < MPEG_INDEX_FRAMES)
+                    {
+                        found [indexed][0] = at;
+                        found [indexed][1] = samples;
+                        indexed++;
+                    }
+                    samples += mp->sample_count;
+                }
                 start += frame_len;
                 mp->resync_count = 0;
                 continue;
@@ -711,6 +765,8 @@ int mpeg_complete_frames (mpeg_sync *mp, refbuf_t *new_block, unsigned offset)
     }
     if (remaining && (new_block->flags & REFBUF_SHARED) == 0)
         new_block->len -= remaining;
+    if (indexed)
+        mpeg_index_block (mp, new_block, found, indexed, samples, whole && expect == new_block->len);
     return remaining;
 }
 
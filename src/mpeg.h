@@ -51,6 +51,9 @@ int  mpeg_get_channels (struct mpeg_sync *mp);
 int  mpeg_has_changed (struct mpeg_sync *mp);
 
 
+/* most frames listed in the index of a block */
+#define MPEG_INDEX_FRAMES   64
+
 #define MPEG_AAC         0
 #define MPEG_LAYER_3     0x1
 #define MPEG_LAYER_2     0x2
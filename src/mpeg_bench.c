@@ -0,0 +1,177 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* mpeg_bench.c
+ *
+ * standalone check and timing of the frame sync candidate scan against a
+ * plain byte loop, over generated mp3, aac and ts streams. Built and run by
+ * make check, exiting non-zero if the two ever disagree on a position. The
+ * argument is the number of timed rounds over each 1MB sample. Building it
+ * with -mno-sse2 (x86) times the byte loop fallback on its own.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mpeg_scan.h"
+
+#define SAMPLE_LEN      (1024*1024)
+
+static unsigned int seed = 12345;
+
+static unsigned char next_byte (void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0xFF;
+}
+
+
+/* the scan as it was before, one byte at a time */
+static unsigned char *byte_sync_candidate (unsigned char *p, int len)
+{
+    unsigned char *end = p + len;
+
+    for (; p < end; p++)
+    {
+        switch (*p)
+        {
+            case 0xFF: case 0x47: case 'I': case 'T': case 'A':
+                return p;
+        }
+    }
+    return NULL;
+}
+
+
+/* frames of header then payload, the payload either random like compressed
+ * audio or silence which leaves long runs without a candidate */
+static void fill_frames (unsigned char *buf, int len, const unsigned char *hdr, int hdrlen, int framelen, int silent)
+{
+    int pos = 0, i;
+
+    while (pos < len)
+    {
+        for (i = 0; i < framelen && pos < len; i++, pos++)
+        {
+            if (i < hdrlen)
+                buf[pos] = hdr[i];
+            else
+                buf[pos] = silent ? 0 : next_byte();
+        }
+    }
+}
+
+
+/* walk every candidate from each starting alignment and compare */
+static int check_positions (unsigned char *buf, int len)
+{
+    int align;
+
+    for (align = 0; align < 16; align++)
+    {
+        unsigned char *p = buf + align;
+        int remaining = len - align;
+
+        while (remaining > 0)
+        {
+            unsigned char *v = find_sync_candidate (p, remaining);
+            unsigned char *b = byte_sync_candidate (p, remaining);
+
+            if (v != b)
+            {
+                printf ("mismatch at offset %ld, vector %ld, byte %ld\n", (long)(p - buf),
+                        v ? (long)(v - buf) : -1L, b ? (long)(b - buf) : -1L);
+                return -1;
+            }
+            if (b == NULL)
+                break;
+            remaining -= (b - p) + 1;
+            p = b + 1;
+        }
+    }
+    return 0;
+}
+
+
+static double time_scan (unsigned char *(*scan)(unsigned char *, int), unsigned char *buf, int len, int rounds, unsigned long *found)
+{
+    clock_t start = clock();
+    int i;
+
+    *found = 0;
+    for (i = 0; i < rounds; i++)
+    {
+        unsigned char *p = buf;
+        int remaining = len;
+
+        while (remaining > 0)
+        {
+            unsigned char *c = scan (p, remaining);
+
+            if (c == NULL)
+                break;
+            (*found)++;
+            remaining -= (c - p) + 1;
+            p = c + 1;
+        }
+    }
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+int main (int argc, char **argv)
+{
+    static const unsigned char mp3_hdr[] = { 0xFF, 0xFB, 0x90, 0x64 };
+    static const unsigned char aac_hdr[] = { 0xFF, 0xF1, 0x50, 0x80, 0x2E, 0x7F, 0xFC };
+    static const unsigned char ts_hdr[] = { 0x47, 0x01, 0x00, 0x10 };
+    struct
+    {
+        const char *name;
+        const unsigned char *hdr;
+        int hdrlen, framelen, silent;
+    } samples[] = {
+        { "mp3",        mp3_hdr, sizeof (mp3_hdr), 417, 0 },
+        { "mp3 silent", mp3_hdr, sizeof (mp3_hdr), 417, 1 },
+        { "aac",        aac_hdr, sizeof (aac_hdr), 371, 0 },
+        { "aac silent", aac_hdr, sizeof (aac_hdr), 371, 1 },
+        { "ts",         ts_hdr,  sizeof (ts_hdr),  188, 0 },
+        { "ts silent",  ts_hdr,  sizeof (ts_hdr),  188, 1 },
+    };
+    unsigned char *buf = malloc (SAMPLE_LEN);
+    int rounds = 20, i, failed = 0;
+
+    if (argc == 2)
+        rounds = atoi (argv[1]);
+    if (buf == NULL || rounds < 1)
+        return 1;
+
+    for (i = 0; i < (int)(sizeof (samples) / sizeof (samples[0])); i++)
+    {
+        unsigned long vfound, bfound;
+        double vtime, btime, mb = (double)SAMPLE_LEN * rounds / (1024*1024);
+
+        fill_frames (buf, SAMPLE_LEN, samples[i].hdr, samples[i].hdrlen, samples[i].framelen, samples[i].silent);
+        if (check_positions (buf, SAMPLE_LEN) < 0)
+        {
+            printf ("%-10s positions differ\n", samples[i].name);
+            failed = 1;
+            continue;
+        }
+        vtime = time_scan (find_sync_candidate, buf, SAMPLE_LEN, rounds, &vfound);
+        btime = time_scan (byte_sync_candidate, buf, SAMPLE_LEN, rounds, &bfound);
+        if (vfound != bfound)
+        {
+            printf ("%-10s candidate counts differ, %lu and %lu\n", samples[i].name, vfound, bfound);
+            failed = 1;
+            continue;
+        }
+        printf ("%-10s %8lu candidates, scan %8.1f MB/s, byte loop %8.1f MB/s\n", samples[i].name,
+                vfound / rounds, vtime > 0 ? mb / vtime : 0.0, btime > 0 ? mb / btime : 0.0);
+    }
+    free (buf);
+    return failed;
+}
@@ -0,0 +1,76 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ */
+
+/* mpeg_scan.h
+ *
+ * scan for bytes that could start a frame or tag, shared by mpeg.c and the
+ * mpeg_bench check program. This is for resyncing when the stream type is
+ * not known. Once it is, the marker byte is found with memchr, which the C
+ * library already vectorises, and the check_for_* and match_syncbits
+ * functions only validate headers at a given position rather than scan.
+ *
+ */
+#ifndef __MPEG_SCAN_H
+#define __MPEG_SCAN_H
+
+#include <stddef.h>
+#include "compat.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/* return the first of len bytes from p that could start a frame or tag when
+ * the stream type is not known yet, ie 0xFF, 0x47 or the start of ID3, TAG
+ * or APETAGEX, NULL if there is none. Runs of other data are passed over a
+ * vector at a time where the cpu always has the instructions for it.
+ */
+static unsigned char *find_sync_candidate (unsigned char *p, int len)
+{
+    unsigned char *end = p + len;
+
+#if defined(__SSE2__)
+    const __m128i ff = _mm_set1_epi8 ((char)0xFF), ts = _mm_set1_epi8 (0x47),
+          i = _mm_set1_epi8 ('I'), t = _mm_set1_epi8 ('T'), a = _mm_set1_epi8 ('A');
+
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i v = _mm_loadu_si128 ((const __m128i *)p);
+        __m128i m = _mm_or_si128 (_mm_cmpeq_epi8 (v, ff), _mm_cmpeq_epi8 (v, ts));
+        int bits;
+
+        m = _mm_or_si128 (m, _mm_or_si128 (_mm_cmpeq_epi8 (v, i), _mm_cmpeq_epi8 (v, t)));
+        bits = _mm_movemask_epi8 (_mm_or_si128 (m, _mm_cmpeq_epi8 (v, a)));
+        if (bits)
+            return p + bit_ctz (bits);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const uint8x16_t ff = vdupq_n_u8 (0xFF), ts = vdupq_n_u8 (0x47),
+          i = vdupq_n_u8 ('I'), t = vdupq_n_u8 ('T'), a = vdupq_n_u8 ('A');
+
+    for (; end - p >= 16; p += 16)
+    {
+        uint8x16_t v = vld1q_u8 (p);
+        uint8x16_t m = vorrq_u8 (vceqq_u8 (v, ff), vceqq_u8 (v, ts));
+
+        m = vorrq_u8 (m, vorrq_u8 (vceqq_u8 (v, i), vceqq_u8 (v, t)));
+        if (vmaxvq_u8 (vorrq_u8 (m, vceqq_u8 (v, a))))
+            break;  // the byte loop finds which one
+    }
+#endif
+    for (; p < end; p++)
+    {
+        switch (*p)
+        {
+            case 0xFF: case 0x47: case 'I': case 'T': case 'A':
+                return p;
+        }
+    }
+    return NULL;
+}
+
+#endif /* __MPEG_SCAN_H */
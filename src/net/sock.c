@@ -1064,6 +1064,26 @@ void sock_set_mss (sock_t sock, int mss_size)
 #endif
 }
 
+/* limit the send rate in bytes per second, ~0 for no limit */
+int sock_set_pacing_rate (sock_t sock, unsigned int rate)
+{
+#ifdef SO_MAX_PACING_RATE
+    return setsockopt (sock, SOL_SOCKET, SO_MAX_PACING_RATE, (char *) &rate, sizeof(rate));
+#else
+    return -1;
+#endif
+}
+
+/* report writable only once unsent data drops below bytes, 0 for the default */
+int sock_set_notsent_lowat (sock_t sock, unsigned int bytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    return setsockopt (sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (char *) &bytes, sizeof(bytes));
+#else
+    return -1;
+#endif
+}
+
 void sock_set_send_buffer (sock_t sock, int win_size)
 {
     setsockopt (sock, SOL_SOCKET, SO_SNDBUF, (char *) &win_size, sizeof(win_size));
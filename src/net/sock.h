@@ -99,6 +99,8 @@ ssize_t sock_writev (sock_t sock, WSABUF *iov, size_t count);
 # define sock_listen _mangle(sock_listen)
 # define sock_set_send_buffer _mangle(sock_set_send_buffer)
 # define sock_set_mss _mangle(sock_set_mss)
+# define sock_set_pacing_rate _mangle(sock_set_pacing_rate)
+# define sock_set_notsent_lowat _mangle(sock_set_notsent_lowat)
 # define sock_accept _mangle(sock_accept)
 # define sock_create_pipe_emulation _mangle(sock_create_pipe_emulation)
 #endif
@@ -123,6 +125,8 @@ int sock_set_delay(sock_t sock);
 void sock_set_error(int val);
 int sock_close(sock_t  sock);
 void sock_set_mss (sock_t sock, int mss_size);
+int sock_set_pacing_rate (sock_t sock, unsigned int rate);
+int sock_set_notsent_lowat (sock_t sock, unsigned int bytes);
 
 /* Connection related socket functions */
 sock_t sock_connect_wto(const char *hostname, int port, int timeout);
@@ -24,65 +24,347 @@
 #include <string.h>
 
 #include "refbuf.h"
+#include "thread/thread.h"
+#include "compat.h"
 
 #define CATMODULE "refbuf"
 
 #include "logging.h"
 #include "global.h"
 
+/* blocks are the header followed by the data, the data space being a power
+ * of 2 from 32 bytes up. Larger ones go straight to and from the heap */
+#define REFBUF_CLASS_MIN_SHIFT  5
+#define REFBUF_CLASS_MAX        (1 << (REFBUF_CLASS_MIN_SHIFT + REFBUF_CLASSES - 1))
+
+/* limits in bytes for each class, a thread cache and the shared spares */
+#define REFBUF_CACHE_BYTES      (512*1024)
+#define REFBUF_SPARE_BYTES      (4*1024*1024)
+
+static pthread_key_t refbuf_cache_key;
+static mutex_t refbuf_cache_lock;
+static refbuf_cache_t *refbuf_caches;
+static refbuf_t *refbuf_spare [REFBUF_CLASSES];
+static int refbuf_spare_count [REFBUF_CLASSES];
+static int refbuf_allocated [REFBUF_CLASSES];
+
+
+static unsigned int refbuf_class_limit (int class, unsigned int bytes, unsigned int most)
+{
+    unsigned int limit = bytes >> (REFBUF_CLASS_MIN_SHIFT + class);
+
+    if (limit < 8) return 8;
+    return limit > most ? most : limit;
+}
+
+
+static int refbuf_class (unsigned int space)
+{
+    int class = 0;
+
+    while ((1U << (REFBUF_CLASS_MIN_SHIFT + class)) < space)
+        class++;
+    return class;
+}
+
 
 void refbuf_initialize(void)
 {
+    pthread_key_create (&refbuf_cache_key, NULL);
+    thread_mutex_create (&refbuf_cache_lock);
 }
 
 void refbuf_shutdown(void)
 {
+    int class;
+
+    for (class = 0; class < REFBUF_CLASSES; class++)
+    {
+        refbuf_t *refbuf = atomic_swap (&refbuf_spare [class], NULL);
+
+        while (refbuf)
+        {
+            refbuf_t *next = refbuf->next;
+            free (refbuf);
+            refbuf = next;
+        }
+        refbuf_spare_count [class] = 0;
+    }
+    thread_mutex_destroy (&refbuf_cache_lock);
+}
+
+
+/* blocks freed by the calling thread are kept in this cache */
+void refbuf_cache_attach (refbuf_cache_t *cache)
+{
+    thread_mutex_lock (&refbuf_cache_lock);
+    cache->next = refbuf_caches;
+    refbuf_caches = cache;
+    thread_mutex_unlock (&refbuf_cache_lock);
+    pthread_setspecific (refbuf_cache_key, cache);
 }
 
-#ifdef MY_ALLOC
-refbuf_t *refbuf_new_s (unsigned int size, const char *file, const int line)
+
+void refbuf_cache_detach (refbuf_cache_t *cache)
+{
+    refbuf_cache_t **p;
+    int class;
+
+    pthread_setspecific (refbuf_cache_key, NULL);
+    thread_mutex_lock (&refbuf_cache_lock);
+    for (p = &refbuf_caches; *p; p = &(*p)->next)
+        if (*p == cache)
+        {
+            *p = cache->next;
+            break;
+        }
+    thread_mutex_unlock (&refbuf_cache_lock);
+    for (class = 0; class < REFBUF_CLASSES; class++)
+    {
+        while (cache->free [class])
+        {
+            refbuf_t *refbuf = cache->free [class];
+
+            cache->free [class] = refbuf->next;
+            free (refbuf);
+            atomic_sub (&refbuf_allocated [class], 1);
+        }
+        cache->count [class] = 0;
+    }
+}
+
+
+static void refbuf_push_spare (int class, refbuf_t *first, refbuf_t *last, int count)
+{
+    refbuf_t *head;
+
+    do
+    {
+        head = refbuf_spare [class];
+        last->next = head;
+    } while (atomic_cas (&refbuf_spare [class], head, first) == 0);
+    atomic_add (&refbuf_spare_count [class], count);
+}
+
+
+static refbuf_t *refbuf_block_get (int class)
 {
+    refbuf_cache_t *cache = pthread_getspecific (refbuf_cache_key);
     refbuf_t *refbuf;
 
-    refbuf = (refbuf_t *)my_calloc (file, line, 1, sizeof(refbuf_t));
-    if (refbuf == NULL)
-        abort();
-    refbuf->data = NULL;
-    if (size)
+    if (cache == NULL)
     {
-        refbuf->data = my_calloc (file, line, 1, size);
-        if (refbuf->data == NULL)
-            abort();
+        // no cache so only take from the spares if there are plenty
+        if (refbuf_spare_count [class] < 2)
+            return NULL;
+        refbuf = atomic_swap (&refbuf_spare [class], NULL);
+        if (refbuf)
+        {
+            refbuf_t *last = refbuf->next;
+            int count = 0;
+
+            if (last)
+            {
+                for (count = 1; last->next; last = last->next)
+                    count++;
+                refbuf_push_spare (class, refbuf->next, last, count);
+            }
+            atomic_sub (&refbuf_spare_count [class], count + 1);
+        }
+        return refbuf;
     }
-    refbuf->len = size;
-    refbuf->_count = 1;
-    refbuf->next = NULL;
-    refbuf->associated = NULL;
+    if (cache->free [class] == NULL && refbuf_spare [class])
+    {
+        // the whole stack is taken so no other thread can be popping these
+        refbuf_t *chain = atomic_swap (&refbuf_spare [class], NULL);
+        int count = 0;
 
+        for (refbuf = chain; refbuf; refbuf = refbuf->next)
+            count++;
+        atomic_sub (&refbuf_spare_count [class], count);
+        cache->free [class] = chain;
+        cache->count [class] = count;
+    }
+    refbuf = cache->free [class];
+    if (refbuf == NULL)
+    {
+        cache->misses [class]++;
+        return NULL;
+    }
+    cache->free [class] = refbuf->next;
+    cache->count [class]--;
+    cache->hits [class]++;
     return refbuf;
 }
+
+
+static void refbuf_free_chain (int class, refbuf_t *refbuf)
+{
+    while (refbuf)
+    {
+        refbuf_t *next = refbuf->next;
+        free (refbuf);
+        atomic_sub (&refbuf_allocated [class], 1);
+        refbuf = next;
+    }
+}
+
+
+static void refbuf_block_put (int class, refbuf_t *refbuf)
+{
+    refbuf_cache_t *cache = pthread_getspecific (refbuf_cache_key);
+    unsigned int keep, count;
+    refbuf_t *last;
+
+    if (cache == NULL)
+    {
+        refbuf->next = NULL;
+        if (refbuf_spare_count [class] >= (int)refbuf_class_limit (class, REFBUF_SPARE_BYTES, 2048))
+            refbuf_free_chain (class, refbuf);
+        else
+            refbuf_push_spare (class, refbuf, refbuf, 1);
+        return;
+    }
+    refbuf->next = cache->free [class];
+    cache->free [class] = refbuf;
+    keep = refbuf_class_limit (class, REFBUF_CACHE_BYTES, 256);
+    if (++cache->count [class] <= keep)
+        return;
+    // keep the recently freed, pass the older half on
+    last = cache->free [class];
+    for (count = 1; count < keep/2; count++)
+        last = last->next;
+    refbuf = last->next;
+    last->next = NULL;
+    count = cache->count [class] - count;
+    cache->count [class] -= count;
+    if (refbuf_spare_count [class] >= (int)refbuf_class_limit (class, REFBUF_SPARE_BYTES, 2048))
+    {
+        refbuf_free_chain (class, refbuf);
+        return;
+    }
+    for (last = refbuf; last->next; last = last->next)
+        ;
+    refbuf_push_spare (class, refbuf, last, count);
+}
+
+
+#ifdef MY_ALLOC
+refbuf_t *refbuf_new_s (unsigned int size, const char *file, const int line)
 #else
 refbuf_t *refbuf_new (unsigned int size)
+#endif
 {
-    refbuf_t *refbuf;
+    refbuf_t *refbuf = NULL;
+    unsigned int space = size;
+    int class = 0;
 
-    refbuf = (refbuf_t *)calloc(1, sizeof(refbuf_t));
+    if (size <= REFBUF_CLASS_MAX)
+    {
+        class = refbuf_class (size);
+        space = 1U << (REFBUF_CLASS_MIN_SHIFT + class);
+        refbuf = refbuf_block_get (class);
+    }
     if (refbuf == NULL)
-        abort();
-    refbuf->data = NULL;
-    if (size)
     {
-        refbuf->data = malloc (size);
-        if (refbuf->data == NULL)
+#ifdef MY_ALLOC
+        refbuf = my_calloc (file, line, 1, sizeof (refbuf_t) + space);
+#else
+        refbuf = malloc (sizeof (refbuf_t) + space);
+#endif
+        if (refbuf == NULL)
             abort();
+        if (size <= REFBUF_CLASS_MAX)
+            atomic_add (&refbuf_allocated [class], 1);
     }
+    memset (refbuf, 0, sizeof (refbuf_t));
+    refbuf->data = size ? (char *)(refbuf + 1) : NULL;
     refbuf->len = size;
+    refbuf->space = space;
     refbuf->_count = 1;
-    refbuf->next = NULL;
-    refbuf->associated = NULL;
 
     return refbuf;
 }
+
+
+/* make sure there is room for size bytes, the current contents are kept */
+int refbuf_resize (refbuf_t *refbuf, unsigned int size)
+{
+    char *data;
+
+    if (size <= refbuf->len || (refbuf->data == (char *)(refbuf + 1) && size <= refbuf->space))
+    {
+        refbuf->len = size;
+        return 0;
+    }
+    if (refbuf->data == NULL || refbuf->data == (char *)(refbuf + 1) || refbuf->slab)
+    {
+        data = malloc (size);
+        if (data && refbuf->len)
+            memcpy (data, refbuf->data, refbuf->len);
+    }
+    else
+        data = realloc (refbuf->data, size);
+    if (data == NULL)
+        return -1;
+    if (refbuf->slab)
+    {
+        refbuf_release (refbuf->slab);
+        refbuf->slab = NULL;
+    }
+    refbuf->data = data;
+    refbuf->len = size;
+    return 0;
+}
+
+
+int refbuf_pool_stats (refbuf_pool_stats_t *stats, int count)
+{
+    refbuf_cache_t *cache;
+    int class;
+
+    if (count > REFBUF_CLASSES)
+        count = REFBUF_CLASSES;
+    memset (stats, 0, count * sizeof (refbuf_pool_stats_t));
+    for (class = 0; class < count; class++)
+    {
+        stats [class].size = 1U << (REFBUF_CLASS_MIN_SHIFT + class);
+        stats [class].allocated = refbuf_allocated [class];
+        stats [class].spare = refbuf_spare_count [class];
+    }
+    thread_mutex_lock (&refbuf_cache_lock);
+    for (cache = refbuf_caches; cache; cache = cache->next)
+        for (class = 0; class < count; class++)
+        {
+            stats [class].cached += cache->count [class];
+            stats [class].hits += cache->hits [class];
+            stats [class].misses += cache->misses [class];
+        }
+    thread_mutex_unlock (&refbuf_cache_lock);
+    return count;
+}
+
+
+/* counts are shared between threads. Taking a reference needs no ordering as
+ * the caller already holds one, but the final release has to see every prior
+ * use of the buffer. BUFFER_LOCAL_USE marks those only ever used by one owner.
+ * Build with REFBUF_DEBUG to trap use of released buffers.
+ */
+#ifdef REFBUF_DEBUG
+#define REFBUF_FREED            0xdeadbeefU
+
+static void refbuf_check (refbuf_t *self, const char *action)
+{
+    unsigned int count = atomic_load_acquire (&self->_count);
+
+    if (count == 0 || count == REFBUF_FREED)
+    {
+        ERROR3 ("%s of released buffer %p (count %x)", action, self, count);
+        abort();
+    }
+}
+#else
+#define refbuf_check(r,a)
 #endif
 
 
@@ -90,9 +372,14 @@ void refbuf_addref(refbuf_t *self)
 {
     if (self == NULL)
         return;
-    self->_count++;
+    refbuf_check (self, "addref");
+    if (self->flags & BUFFER_LOCAL_USE)
+        self->_count++;
+    else
+        atomic_ref_inc (&self->_count);
 }
 
+
 refbuf_t *refbuf_copy(refbuf_t *orig)
 {
     refbuf_t *ret = refbuf_new (orig->len), *ref = ret;
@@ -109,6 +396,21 @@ refbuf_t *refbuf_copy(refbuf_t *orig)
 }
 
 
+/* make a block of the len bytes at data, which lie within slab. The slab is
+ * held until the block is released, so many blocks can share one allocation
+ */
+refbuf_t *refbuf_carve (refbuf_t *slab, char *data, unsigned int len)
+{
+    refbuf_t *refbuf = refbuf_new (REFBUF_CARVED_SPACE);
+
+    refbuf->data = data;
+    refbuf->len = len;
+    refbuf->slab = slab;
+    refbuf_addref (slab);
+    return refbuf;
+}
+
+
 static void refbuf_release_associated (refbuf_t *ref)
 {
     if (ref == NULL)
@@ -117,7 +419,7 @@ static void refbuf_release_associated (refbuf_t *ref)
     {
         refbuf_t *to_go = ref;
         ref = to_go->next;
-        if (to_go->_count == 1)
+        if (atomic_load_acquire (&to_go->_count) == 1)
             to_go->next = NULL;
         refbuf_release (to_go);
     }
@@ -125,16 +427,37 @@ static void refbuf_release_associated (refbuf_t *ref)
 
 void refbuf_release(refbuf_t *self)
 {
+    unsigned int count;
+
     if (self == NULL)
         return;
-    self->_count--;
-    if (self->_count == 0)
+    refbuf_check (self, "release");
+    if (self->flags & BUFFER_LOCAL_USE)
+        count = --self->_count;
+    else if (atomic_load_acquire (&self->_count) == 1)
+        count = self->_count = 0;   // the only reference so nobody else can take one
+    else
+        count = atomic_ref_dec (&self->_count);
+    if (count == 0)
     {
+#ifdef REFBUF_DEBUG
+        self->_count = REFBUF_FREED;
+#endif
         refbuf_release_associated (self->associated);
         if (self->next)
             DEBUG0 ("next not null");
-        free(self->data);
-        free(self);
+        if (self->frames)
+            refbuf_release (self->frames);
+        if (self->slab)
+            refbuf_release (self->slab);
+        else if (self->data != (char *)(self + 1))
+            free(self->data);   /* replaced by a resize */
+        if (self->space > REFBUF_CLASS_MAX)
+        {
+            free(self);
+            return;
+        }
+        refbuf_block_put (refbuf_class (self->space), self);
     }
 }
 
@@ -19,6 +19,7 @@
 #define __REFBUF_H__
 
 #include <sys/types.h>
+#include "compat.h"
 
 typedef struct _refbuf_tag
 {
@@ -28,9 +29,51 @@ typedef struct _refbuf_tag
     struct _refbuf_tag *associated;
     char *data;
     unsigned int len;
+    unsigned int space;     /* data bytes allocated after the header */
+    struct _refbuf_tag *slab;   /* holds the data when carved from a larger block */
+    struct _refbuf_tag *frames; /* refbuf_frames_t index of the data, if known.
+                                 * Its associated block, once set, holds the
+                                 * FLV tags for the frames */
 
 } refbuf_t;
 
+/* where the frames in a queue block start and how far into the block each is
+ * in samples. There may be more frames than listed but samples covers all,
+ * whole is set if the listed frames are all there is in the block */
+typedef struct
+{
+    uint64_t start;             /* stream position in samples, set when queued */
+    unsigned int samplerate;
+    unsigned int samples;
+    unsigned int count;
+    unsigned int whole;
+    struct
+    {
+        unsigned int offset;
+        unsigned int samples;
+    } frame [];
+} refbuf_frames_t;
+
+/* power of 2 size classes of pooled buffers, 32 bytes to 64k */
+#define REFBUF_CLASSES          12
+
+typedef struct _refbuf_cache_t
+{
+    refbuf_t *free [REFBUF_CLASSES];
+    unsigned int count [REFBUF_CLASSES];
+    uint64_t hits [REFBUF_CLASSES], misses [REFBUF_CLASSES];
+    struct _refbuf_cache_t *next;
+} refbuf_cache_t;
+
+typedef struct
+{
+    unsigned int size;
+    unsigned int allocated;     /* blocks currently taken from the heap */
+    unsigned int cached;        /* of those, held in thread caches */
+    unsigned int spare;         /* and those on the shared stack */
+    uint64_t hits, misses;
+} refbuf_pool_stats_t;
+
 void refbuf_initialize(void);
 void refbuf_shutdown(void);
 
@@ -43,10 +86,19 @@ refbuf_t *refbuf_new(unsigned int size);
 void refbuf_addref(refbuf_t *self);
 void refbuf_release(refbuf_t *self);
 refbuf_t *refbuf_copy(refbuf_t *orig);
+refbuf_t *refbuf_carve (refbuf_t *slab, char *data, unsigned int len);
+int  refbuf_resize (refbuf_t *refbuf, unsigned int size);
+
+void refbuf_cache_attach (refbuf_cache_t *cache);
+void refbuf_cache_detach (refbuf_cache_t *cache);
+int  refbuf_pool_stats (refbuf_pool_stats_t *stats, int count);
 
 
 #define PER_CLIENT_REFBUF_SIZE  4096
 
+/* space a carved block keeps after its header, for small per block extras */
+#define REFBUF_CARVED_SPACE     32
+
 #define WRITE_BLOCK_GENERIC     01000
 #define REFBUF_SHARED           02000
 #define BUFFER_LOCAL_USE        04000
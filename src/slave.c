@@ -123,19 +123,22 @@ rwlock_t workers_lock;
 struct _client_functions relay_client_ops =
 {
     relay_read,
-    relay_release
+    relay_release,
+    CLIENT_OPS_RELAY
 };
 
 struct _client_functions relay_startup_ops =
 {
     relay_startup,
-    relay_release
+    relay_release,
+    CLIENT_OPS_RELAY
 };
 
 struct _client_functions relay_init_ops =
 {
     relay_initialise,
-    relay_release
+    relay_release,
+    CLIENT_OPS_RELAY
 };
 
 
@@ -1120,7 +1123,7 @@ static void slave_startup (void)
 
     redirector_setup (config);
     stats_global (config);
-    workers_adjust (config->workers_count);
+    workers_apply_config (config);
     yp_initialize (config);
     update_relays (config);
     config_release_config();
@@ -1206,6 +1209,7 @@ static void _slave_thread(void)
             }
         }
         worker_balance_trigger (current.tv_sec);
+        worker_autoscale (current.tv_sec);
         thread_sleep (1000000);
     }
     connection_thread_shutdown();
@@ -1629,22 +1633,15 @@ static int relay_startup (client_t *client)
         client->schedule_ms = client->worker->time_ms + 50;
         return 0;
     }
-    if (worker->move_allocations)
+    if (worker->steal_to)
     {
         int ret = 0;
         worker_t *dest_worker;
 
         thread_rwlock_rlock (&workers_lock);
-        dest_worker = worker_selected ();
-        if (dest_worker != worker)
-        {
-            long diff = worker->count - dest_worker->count;
-            if (diff > 5)
-            {
-                worker->move_allocations--;
-                ret = client_change_worker (client, dest_worker);
-            }
-        }
+        dest_worker = worker_steal_dest (worker, 1);
+        if (dest_worker)
+            ret = client_change_worker (client, dest_worker);
         thread_rwlock_unlock (&workers_lock);
         if (ret)
             return ret;
@@ -64,6 +64,9 @@
 
 #define MAX_FALLBACK_DEPTH 10
 
+/* most blocks queued from one source read when draining its socket */
+#define SOURCE_DRAIN_BLOCKS 64
+
 
 /* avl tree helper */
 static void _parse_audio_info (source_t *source, const char *s);
@@ -74,6 +77,7 @@ static int  source_client_shutdown (client_t *client);
 static int  source_client_http_send (client_t *client);
 static int  send_to_listener (client_t *client);
 static int  send_listener (source_t *source, client_t *client);
+static int  listener_queue_needs_lock (client_t *client);
 static int  wait_for_restart (client_t *client);
 static int  wait_for_other_listeners (client_t *client);
 
@@ -81,6 +85,9 @@ static int  http_source_listener (client_t *client);
 static int  http_source_intro (client_t *client);
 static int  http_source_introfile (client_t *client);
 static int  locate_start_on_queue (source_t *source, client_t *client);
+static int  listener_paced (source_t *source, client_t *client, long lag);
+static void listener_queue_written (client_t *client, refbuf_t *first, unsigned int written);
+static void listener_send_complete (client_t *client, refbuf_t *first, unsigned int len, int ret);
 static int  listener_change_worker (client_t *client, source_t *source);
 static int  source_change_worker (source_t *source, client_t *client);
 static int  source_client_callback (client_t *client);
@@ -95,37 +102,43 @@ static void source_run_script (char *command, char *mountpoint);
 struct _client_functions source_client_ops = 
 {
     source_client_read,
-    client_destroy
+    client_destroy,
+    CLIENT_OPS_SOURCE
 };
 
 struct _client_functions source_client_halt_ops = 
 {
     source_client_shutdown,
-    source_client_release
+    source_client_release,
+    CLIENT_OPS_SOURCE
 };
 
 struct _client_functions listener_client_ops = 
 {
     send_to_listener,
-    client_destroy
+    client_destroy,
+    CLIENT_OPS_LISTENER
 };
 
 struct _client_functions listener_pause_ops = 
 {
     wait_for_restart,
-    client_destroy
+    client_destroy,
+    CLIENT_OPS_LISTENER
 };
 
 struct _client_functions listener_wait_ops = 
 {
     wait_for_other_listeners,
-    client_destroy
+    client_destroy,
+    CLIENT_OPS_LISTENER
 };
 
 struct _client_functions source_client_http_ops =
 {
     source_client_http_send,
-    source_client_release
+    source_client_release,
+    CLIENT_OPS_SOURCE
 };
 
 
@@ -163,6 +176,7 @@ source_t *source_reserve (const char *mount, int flags)
 
         thread_rwlock_create (&src->lock);
         thread_spin_create (&src->shrink_lock);
+        client_waiters_init (&src->waiters);
         src->flags |= SOURCE_RESERVED;
 
         avl_insert (global.source_tree, src);
@@ -266,7 +280,10 @@ void source_clear_source (source_t *source)
         source->dumpfile = NULL;
     }
 
-    /* flush out the stream data, we don't want any left over */
+    /* flush out the stream data, we don't want any left over. Listeners
+     * only walk the queue without the lock while the source is running */
+    if (source->retired)
+        source->stream_data = source->retired;
     while (source->stream_data)
     {
         refbuf_t *to_go = source->stream_data;
@@ -274,12 +291,19 @@ void source_clear_source (source_t *source)
         to_go->next = NULL;
         refbuf_release (to_go);
     }
+    source->retired = source->retired_end = NULL;
+    source->retired_epoch = 0;
     source->min_queue_point = NULL;
     source->stream_data_tail = NULL;
+    source->queue_start = 0;
+    source->queue_index_head = 0;
+    source->queue_index_count = 0;
+    source->queue_samples = 0;
 
     source->min_queue_size = 0;
     source->min_queue_offset = 0;
     source->default_burst_size = 0;
+    source->default_burst_ms = 0;
     source->queue_size = 0;
     source->queue_size_limit = 0;
     source->client_stats_update = 0;
@@ -317,10 +341,12 @@ static int _free_source (void *p)
     thread_rwlock_unlock (&source->lock);
     thread_rwlock_destroy (&source->lock);
     thread_spin_destroy (&source->shrink_lock);
+    client_waiters_destroy (&source->waiters);
 
     INFO1 ("freeing source \"%s\"", source->mount);
     format_plugin_clear (source->format, source->client);
     free (source->format);
+    free (source->queue_index);
     free (source->mount);
     free (source);
     return 1;
@@ -414,6 +440,140 @@ static void update_source_stats (source_t *source)
 }
 
 
+/* release trimmed blocks once the workers have all moved on from them. The
+ * trimmed ones since the last stamp are stamped in turn */
+static void source_queue_reclaim (source_t *source)
+{
+    while (source->retired)
+    {
+        if (source->retired_epoch == 0)
+        {
+            source->retired_end = source->stream_data;
+            source->retired_epoch = worker_epoch_retire ();
+            return;
+        }
+        if (worker_epoch_passed (source->retired_epoch) == 0)
+            return;
+        while (source->retired != source->retired_end)
+        {
+            refbuf_t *to_go = source->retired;
+            source->retired = to_go->next;
+            to_go->next = NULL;
+            refbuf_release (to_go);
+        }
+        source->retired_epoch = 0;
+        if (source->retired == source->stream_data)
+            source->retired = NULL;
+    }
+}
+
+
+/* record a block appended to the queue, pos is where it starts in the stream */
+static void source_index_add (source_t *source, refbuf_t *refbuf, uint64_t pos)
+{
+    source_queue_index *entry;
+
+    if (source->queue_index_count == source->queue_index_size)
+    {
+        unsigned int i, size = source->queue_index_size ? source->queue_index_size << 1 : 256;
+        source_queue_index *index = malloc (size * sizeof (*index));
+
+        if (index == NULL)
+            return;
+        for (i = 0; i < source->queue_index_count; i++)
+            index[i] = source->queue_index [(source->queue_index_head + i) & (source->queue_index_size-1)];
+        free (source->queue_index);
+        source->queue_index = index;
+        source->queue_index_size = size;
+        source->queue_index_head = 0;
+    }
+    entry = &source->queue_index [(source->queue_index_head + source->queue_index_count) & (source->queue_index_size-1)];
+    entry->block = refbuf;
+    entry->pos = pos;
+    entry->samples = source->queue_samples;
+    source->queue_index_count++;
+    if (refbuf->frames)
+    {
+        refbuf_frames_t *index = (refbuf_frames_t *)refbuf->frames->data;
+        index->start = source->queue_samples;
+        source->queue_samples += index->samples;
+    }
+}
+
+
+/* drop the oldest entry if it refers to the block trimmed off the queue */
+static void source_index_trim (source_t *source, refbuf_t *refbuf)
+{
+    if (source->queue_index_count && source->queue_index [source->queue_index_head].block == refbuf)
+    {
+        source->queue_index_head = (source->queue_index_head + 1) & (source->queue_index_size-1);
+        source->queue_index_count--;
+    }
+}
+
+
+/* find the queued block holding the stream position, or the sample position
+ * if samples is set, the oldest block if before that. NULL if the index is
+ * not usable */
+static source_queue_index *source_index_holding (source_t *source, uint64_t pos, int samples)
+{
+    unsigned int low = 0, high = source->queue_index_count, mask = source->queue_index_size-1;
+
+    if (high == 0 || source->queue_index [source->queue_index_head].block != source->stream_data)
+        return NULL;
+    high--;
+    while (low < high)
+    {
+        unsigned int mid = (low + high + 1) >> 1;
+        source_queue_index *entry = &source->queue_index [(source->queue_index_head + mid) & mask];
+
+        if ((samples ? entry->samples : entry->pos) <= pos)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return &source->queue_index [(source->queue_index_head + low) & mask];
+}
+
+
+/* where in the block a listener can start for a position relative to the
+ * block start, in bytes or samples. That is the first indexed frame at or
+ * after it, otherwise the end of the block so the next block is used */
+static unsigned int source_join_offset (refbuf_t *refbuf, uint64_t rel, int samples)
+{
+    if (rel == 0)
+        return 0;
+    if (refbuf->frames)
+    {
+        refbuf_frames_t *index = (refbuf_frames_t *)refbuf->frames->data;
+        unsigned int i;
+
+        for (i = 0; i < index->count; i++)
+            if ((samples ? index->frame[i].samples : index->frame[i].offset) >= rel)
+                return index->frame[i].offset;
+    }
+    return refbuf->len;
+}
+
+
+/* nothing has arrived from the source, returns -1 if it has timed out */
+static int source_read_idle (source_t *source, time_t current)
+{
+    if (source->last_read + (time_t)3 == current)
+        WARN1 ("Nothing received on %s for 3 seconds", source->mount);
+    if (source->last_read + (time_t)source->timeout < current)
+    {
+        DEBUG3 ("last %ld, timeout %d, now %ld", (long)source->last_read,
+                source->timeout, (long)current);
+        WARN1 ("Disconnecting %s due to socket timeout", source->mount);
+        source->flags &= ~SOURCE_RUNNING;
+        source->flags |= SOURCE_TIMEOUT;
+        return -1;
+    }
+    return 0;
+}
+
+
 /* get some data from the source. The stream data is placed in a refbuf
  * and sent back, however NULL is also valid as in the case of a short
  * timeout and there's no data pending.
@@ -422,16 +582,16 @@ int source_read (source_t *source)
 {
     client_t *client = source->client;
     refbuf_t *refbuf = NULL;
-    int skip = 1, loop = 1;
+    int skip = 1, loop = 1, drain = 0;
     time_t current = client->worker->current_time.tv_sec;
     long queue_size_target;
     int fds = 0;
+    uint64_t read_bytes = source->format->read_bytes;
 
     if (global.running != ICE_RUNNING)
         source->flags &= ~SOURCE_RUNNING;
     do
     {
-        source->wakeup = 0;
         client->schedule_ms = client->worker->time_ms;
         if (source->flags & SOURCE_LISTENERS_SYNC)
         {
@@ -477,7 +637,16 @@ int source_read (source_t *source)
                 return 1;
         }
 
-        fds = util_timed_wait_for_fd (client->connection.sock, 0);
+        /* with a readiness notifier the worker is woken as data arrives, so
+         * read until the socket is empty instead of polling it first */
+        if (worker_has_readiness (client->worker) && not_ssl_connection (&client->connection))
+        {
+            drain = 1;
+            loop = SOURCE_DRAIN_BLOCKS;
+            fds = 1;
+        }
+        else
+            fds = util_timed_wait_for_fd (client->connection.sock, 0);
         if (fds < 0)
         {
             if (! sock_recoverable (sock_error()))
@@ -490,27 +659,23 @@ int source_read (source_t *source)
         }
         if (fds == 0)
         {
-            if (source->last_read + (time_t)3 == current)
-                WARN1 ("Nothing received on %s for 3 seconds", source->mount);
-            if (source->last_read + (time_t)source->timeout < current)
-            {
-                DEBUG3 ("last %ld, timeout %d, now %ld", (long)source->last_read,
-                        source->timeout, (long)current);
-                WARN1 ("Disconnecting %s due to socket timeout", source->mount);
-                source->flags &= ~SOURCE_RUNNING;
-                source->flags |= SOURCE_TIMEOUT;
+            if (source_read_idle (source, current) < 0)
                 return 0;
-            }
             source->skip_duration = (int)((source->skip_duration + 12) * 1.1);
             if (source->skip_duration > 400)
                 source->skip_duration = 400;
             break;
         }
 
-        source->last_read = current;
+        if (drain == 0)
+            source->last_read = current;
         do
         {
+            uint64_t before = source->format->read_bytes;
+
             refbuf = source->format->get_buffer (source);
+            if (drain && source->format->read_bytes != before)
+                source->last_read = current;
             if (refbuf)
             {
                 if (skip)
@@ -528,15 +693,18 @@ int source_read (source_t *source)
                     config_release_config();
 
                     source->stream_data = refbuf;
+                    atomic_store_release (&source->queue_start, source->client->queue_pos - refbuf->len);
                     source->min_queue_point = refbuf;
                     source->min_queue_offset = 0;
                 }
+                source_index_add (source, refbuf, source->client->queue_pos - refbuf->len);
+                atomic_barrier();   // block complete before lockless listeners can reach it
                 if (source->stream_data_tail)
                     source->stream_data_tail->next = refbuf;
 
                 source->stream_data_tail = refbuf;
                 source->queue_size += refbuf->len;
-                source->wakeup = 1;
+                client_waiters_wake (&source->waiters);
 
                 /* move the starting point for new listeners */
                 source->min_queue_offset += refbuf->len;
@@ -573,11 +741,25 @@ int source_read (source_t *source)
                     source->flags &= ~SOURCE_RUNNING;
                     return 0;
                 }
+                if (drain && source->format->read_bytes != before && loop > 1)
+                {
+                    loop--;
+                    continue;   // partial block or metadata, the socket may have more
+                }
+                if (drain && loop > 1)
+                    drain = 2;  // emptied, so wait for the worker to be woken
                 break;
             }
             loop--;
         } while (loop);
 
+        if (drain && source->format->read_bytes == read_bytes)
+        {
+            if (source_read_idle (source, current) < 0)
+                return 0;
+            break;
+        }
+
         /* lets see if we have too much data in the queue */
         loop = 40 + (source->incoming_rate >> 15); // scale max on high bitrates
         if (source->shrink_time && source->shrink_time <= client->worker->time_ms)
@@ -596,20 +778,28 @@ int source_read (source_t *source)
             if (to_go->next == NULL) // always leave at least one on the queue
                 break;
             source->stream_data = to_go->next;
+            // published before the block can be retired
+            atomic_store_release (&source->queue_start, source->queue_start + to_go->len);
             source->queue_size -= to_go->len;
+            source_index_trim (source, to_go);
             if (source->min_queue_point == to_go)
             {
                 // adjust min queue in line with expectations
                 source->min_queue_offset -= to_go->len;
                 source->min_queue_point = to_go->next;
             }
-            to_go->next = NULL;
-            refbuf_release (to_go);
+            if (source->retired == NULL)
+                source->retired = to_go;   // left linked until no listener can be on it
             loop--;
         }
+        source_queue_reclaim (source);
     } while (0);
 
-    if (skip)
+    if (drain == 2)
+        client->schedule_ms = client->worker->time_ms + 500;
+    else if (drain)
+        client->schedule_ms = client->worker->time_ms;
+    else if (skip)
         client->schedule_ms += source->skip_duration;
     return 0;
 }
@@ -627,6 +817,7 @@ void source_listeners_wakeup (source_t *source)
         client->schedule_ms = 0;
         node = avl_get_next (node);
     }
+    client_waiters_wake (&source->waiters);
 }
 
 
@@ -740,8 +931,20 @@ static int source_queue_advance (client_t *client)
     refbuf_t *refbuf;
     long lag;
 
-    if (client->refbuf == NULL && locate_start_on_queue (source, client) < 0)
-        return -1;
+    if (client->refbuf == NULL)
+    {
+        if (client->flags & CLIENT_QUEUE_LOCKLESS)
+            return listener_queue_needs_lock (client);  // joining needs the source index
+        if (locate_start_on_queue (source, client) < 0)
+            return -1;
+    }
+    else if (client->flags & CLIENT_QUEUE_LOCKLESS)
+    {
+        /* the block held from a previous pass is only safe while still queued,
+         * once trimmed it can be released as soon as this pass is over */
+        if (client->queue_pos - client->pos < atomic_load_acquire (&source->queue_start))
+            return listener_queue_needs_lock (client);
+    }
 
     lag = source->client->queue_pos - client->queue_pos;
 
@@ -753,12 +956,16 @@ static int source_queue_advance (client_t *client)
         ret = (offset & 31);
         offset++;
         client->schedule_ms += (source->incoming_adj + ret);
-        client->wakeup = &source->wakeup; // allow for quick wakeup
+        client_wait_on (client, &source->waiters); // allow for quick wakeup
+        if (source->client->queue_pos != client->queue_pos)
+            client->schedule_ms = client->worker->time_ms;  // queued before it was on the list
         return -1;
     }
-    client->wakeup = NULL;
+    client_wait_cancel (client);
     if (lag > source->queue_size || (lag == source->queue_size && client->pos))
     {
+        if (client->flags & CLIENT_QUEUE_LOCKLESS)
+            return listener_queue_needs_lock (client);  // may be stale, confirm under lock
         INFO4 ("Client %" PRIu64 " (%s) has fallen too far behind (%"PRIu64") on %s, removing",
                 client->connection.id, client->connection.ip, client->queue_pos, source->mount);
         stats_lock (source->stats, source->mount);
@@ -775,6 +982,8 @@ static int source_queue_advance (client_t *client)
             //DEBUG1 ("lag is %ld", lag);
         if ((lag+source->incoming_rate) > source->queue_size_limit && client->connection.error == 0)
         {
+            if (client->flags & CLIENT_QUEUE_LOCKLESS)
+                return listener_queue_needs_lock (client);
             // if the listener is really lagging but has been received a decent
             // amount of data then allow a requeue, else allow the drop
             if (client->counter > (source->queue_size_limit << 1))
@@ -807,10 +1016,39 @@ static int source_queue_advance (client_t *client)
     if ((refbuf->flags & SOURCE_QUEUE_BLOCK) == 0 || refbuf->len > 66000)  abort();
 
     if (client->pos < refbuf->len)
+    {
+        unsigned int limit = source->format->direct_limit ? source->format->direct_limit (client) : 0;
+
+        if (limit > (unsigned int)source->listener_send_trigger)
+            limit = source->listener_send_trigger;
+        if (limit)
+        {
+            ret = client_send_pinned (client, refbuf, client->pos, limit);
+            if (ret != -2)
+            {
+                if (ret > 0)
+                    listener_queue_written (client, refbuf, ret);
+                return ret;
+            }
+            if ((client->flags & CLIENT_KERNEL_PACED) == 0 &&
+                    client_send_queue (client, refbuf, client->pos, limit, listener_send_complete) == 0)
+                return -1;  // the result is applied at the end of the worker pass
+            if (refbuf->next && refbuf->len - client->pos < limit)
+            {
+                /* lagging behind, so take several blocks in one go */
+                ret = client_send_blocks (client, refbuf, client->pos, limit);
+                if (ret > 0)
+                    listener_queue_written (client, refbuf, ret);
+                return ret;
+            }
+        }
         ret = source->format->write_buf_to_client (client);
+    }
     else
         ret = 0;
-    /* move to the next buffer if we have finished with the current one */
+    /* move to the next buffer if we have finished with the current one, the
+     * format may have sent several */
+    refbuf = client->refbuf;
     if (client->pos >= refbuf->len && refbuf->next)
     {
         client->refbuf = refbuf->next;
@@ -820,10 +1058,110 @@ static int source_queue_advance (client_t *client)
 }
 
 
+/* after the burst, listeners on pacing mounts have their socket paced by
+ * the kernel a little above the stream rate. They are then only written to
+ * once half a second of data is waiting.
+ * Returns 1 if the listener is to wait.
+ */
+static int listener_paced (source_t *source, client_t *client, long lag)
+{
+    long rate = source->incoming_rate;
+
+    if ((source->flags & SOURCE_KERNEL_PACING) == 0 || rate == 0 ||
+            client->connection.sent_bytes < source->default_burst_size)
+    {
+        if (client->flags & CLIENT_KERNEL_PACED)
+            client_set_pacing (client, 0, 0);
+        return 0;
+    }
+    if ((client->flags & CLIENT_KERNEL_PACED) == 0)
+    {
+        if (client->paced_rate)
+            return 0;   // not available on this socket
+        client_set_pacing (client, rate + (rate >> 2), rate);
+    }
+    else if (rate + (rate >> 2) > client->paced_rate + (client->paced_rate >> 3) ||
+            rate + (rate >> 2) < client->paced_rate - (client->paced_rate >> 3))
+        client_set_pacing (client, rate + (rate >> 2), rate);   // stream rate has drifted
+
+    if ((client->flags & CLIENT_KERNEL_PACED) == 0 || lag >= (rate >> 1) || lag < 0)
+        return 0;
+    client_wait_cancel (client);
+    client->schedule_ms = client->worker->time_ms + ((rate >> 1) - lag) * 1000 / rate;
+    return 1;
+}
+
+
+/* move the listener on through the queue after a send of several blocks. The
+ * source may have moved the listener on meanwhile, in which case only the
+ * private copy of the block is advanced.
+ */
+static void listener_queue_written (client_t *client, refbuf_t *first, unsigned int written)
+{
+    refbuf_t *refbuf = client->refbuf;
+
+    client->counter += written;
+    client->queue_pos += written;
+    if (refbuf == first)
+    {
+        while (1)
+        {
+            unsigned int part = refbuf->len - client->pos;
+
+            if (part > written)
+                part = written;
+            client->pos += part;
+            written -= part;
+            if (client->pos < refbuf->len || refbuf->next == NULL)
+                break;
+            refbuf = refbuf->next;
+            client->pos = 0;
+            if (written == 0)
+                break;
+        }
+        client->refbuf = refbuf;
+    }
+    else if (refbuf && client->pos < refbuf->len)
+        client->pos += written < refbuf->len - client->pos ? written : refbuf->len - client->pos;
+}
+
+
+/* apply a queued send from source_queue_advance as if made directly */
+static void listener_send_complete (client_t *client, refbuf_t *first, unsigned int len, int ret)
+{
+    source_t *source = client->shared_data;
+    worker_t *worker = client->worker;
+
+    if (source)
+        thread_rwlock_rlock (&source->lock);
+    if (ret < (int)len)
+        client->schedule_ms += 10 + client->throttle;
+    if (ret < 0)
+    {
+        if (! sock_recoverable (-ret))
+            client->connection.error = 1;
+    }
+    else if (ret > 0)
+    {
+        client->connection.sent_bytes += ret;
+        listener_queue_written (client, first, ret);
+        if (source)
+        {
+            rate_add (source->out_bitrate, ret, worker->time_ms);
+            source->bytes_sent_since_update += ret;
+        }
+        global_add_bitrates (global.out_bitrate, ret, worker->time_ms);
+    }
+    if (source)
+        thread_rwlock_unlock (&source->lock);
+}
+
+
 static int locate_start_on_queue (source_t *source, client_t *client)
 {
     refbuf_t *refbuf;
     long lag = 0;
+    unsigned int offset = 0;
 
     /* we only want to attempt a burst at connection time, not midstream
      * however streams like theora may not have the most recent page marked as
@@ -837,23 +1175,62 @@ static int locate_start_on_queue (source_t *source, client_t *client)
     }
     else
     {
-        const char *header = httpp_getvar (client->parser, "initial-burst");
         const char *arg = httpp_get_query_param (client->parser, "burst");
         size_t size = source->min_queue_size;
         off_t v = source->default_burst_size;
+        long ms = source->default_burst_ms;
+        source_queue_index *entry = NULL;
+
+        if (arg == NULL)
+            arg = httpp_getvar (client->parser, "initial-burst");
         if (arg)
-            v = atol (arg);
-        else if (header)
-            v = atol (header);
+        {
+            char *end;
+            v = strtol (arg, &end, 10);
+            ms = 0;
+            if (strcmp (end, "ms") == 0)
+            {
+                ms = v;  // bytes only used if the stream has no frame index
+                v = source->default_burst_size;
+            }
+        }
         v -= client->connection.sent_bytes; /* have we sent data already */
         refbuf = source->min_queue_point;
         lag = source->min_queue_offset;
         // DEBUG3 ("size %lld, v %lld, lag %ld", size, v, lag);
-        while (size > v && refbuf && refbuf->next)
+        if (ms > 0 && source->stream_data_tail->frames)
+            entry = source_index_holding (source, source->client->queue_pos - lag, 0);
+        if (entry)
         {
-            size -= refbuf->len;
-            lag -= refbuf->len;
-            refbuf = refbuf->next;
+            /* go back the duration from the newest frame, not past the min queue point */
+            refbuf_frames_t *index = (refbuf_frames_t *)source->stream_data_tail->frames->data;
+            uint64_t want = (uint64_t)ms * index->samplerate / 1000, start = entry->samples;
+
+            if (source->queue_samples - start > want)
+                start = source->queue_samples - want;
+            entry = source_index_holding (source, start, 1);
+            refbuf = entry->block;
+            offset = source_join_offset (refbuf, start > entry->samples ? start - entry->samples : 0, 1);
+            lag = source->client->queue_pos - entry->pos;
+        }
+        else if (size > v && refbuf && refbuf->next)
+        {
+            /* the burst starts on the first frame, or block, from this stream position */
+            uint64_t start = source->client->queue_pos - lag + (size - v);
+
+            entry = source_index_holding (source, start, 0);
+            if (entry)
+            {
+                refbuf = entry->block;
+                offset = source_join_offset (refbuf, start > entry->pos ? start - entry->pos : 0, 0);
+                lag = source->client->queue_pos - entry->pos;
+            }
+            else while (size > v && refbuf && refbuf->next)
+            {
+                size -= refbuf->len;
+                lag -= refbuf->len;
+                refbuf = refbuf->next;
+            }
         }
         if (lag < 0)
             ERROR1 ("Odd, lag is negative %ld", lag);
@@ -861,20 +1238,36 @@ static int locate_start_on_queue (source_t *source, client_t *client)
 
     while (refbuf)
     {
-        if (refbuf->flags & SOURCE_BLOCK_SYNC)
+        if (offset < refbuf->len && (refbuf->flags & SOURCE_BLOCK_SYNC))
         {
+            uint64_t join = source->client->queue_pos - lag + offset;
+            unsigned int back = source->format->join_phase ? source->format->join_phase (client, join) : 0;
+
+            if (back && back <= join)
+            {
+                /* start earlier, if still queued, to be in step with shared framing */
+                source_queue_index *entry = source_index_holding (source, join - back, 0);
+
+                if (entry && entry->pos <= join - back)
+                {
+                    refbuf = entry->block;
+                    offset = join - back - entry->pos;
+                    lag = source->client->queue_pos - entry->pos;
+                }
+            }
             client_set_queue (client, NULL);
             client->refbuf = refbuf;
             client->intro_offset = -1;
-            client->pos = 0;
+            client->pos = offset;
             client->counter = 0;
-            client->queue_pos = source->client->queue_pos - lag;
+            client->queue_pos = source->client->queue_pos - lag + offset;
             client->flags &= ~CLIENT_HAS_INTRO_CONTENT;
             DEBUG4 ("%s Joining queue on %s (%"PRIu64 ", %"PRIu64 ")", &client->connection.ip[0], source->mount, source->client->queue_pos, client->queue_pos);
             return 0;
         }
         lag -= refbuf->len;
         refbuf = refbuf->next;
+        offset = 0;
     }
     client->schedule_ms += 150;
     return -1;
@@ -1010,7 +1403,7 @@ static int http_source_listener (client_t *client)
 
 void source_listener_detach (source_t *source, client_t *client)
 {
-    client->wakeup = NULL;
+    client_wait_cancel (client);
     if (client->check_buffer != http_source_listener) // not in http headers
     {
         refbuf_t *ref = client->refbuf;
@@ -1093,6 +1486,37 @@ static int wait_for_other_listeners (client_t *client)
 
 /* general send routine per listener.
  */
+/* can the listener be sent queue data without the source lock. This is the
+ * usual case, anything else like joining, moving or dropping takes the lock
+ */
+static int listener_queue_lockless (source_t *source, client_t *client)
+{
+    worker_t *worker, *source_worker;
+
+    if (client->check_buffer != source_queue_advance || client->connection.error)
+        return 0;
+    if ((source->flags & (SOURCE_RUNNING|SOURCE_PAUSE_LISTENERS|SOURCE_TERMINATING|SOURCE_LISTENERS_SYNC)) != SOURCE_RUNNING)
+        return 0;
+    worker = client->worker;
+    if (worker->move_allocations == 0 || worker_count < 2)
+        return 1;
+    // the same checks as listener_change_worker, a move needs the lock
+    source_worker = source->client->worker;
+    if (source_worker == worker)
+        return worker->load <= WORKER_LOAD_HIGH;
+    return source_worker->load > worker->load + WORKER_LOAD_MARGIN;
+}
+
+
+/* called within the lockless send when the lock is needed, the send is then
+ * repeated with the lock held */
+static int listener_queue_needs_lock (client_t *client)
+{
+    client->flags &= ~CLIENT_QUEUE_LOCKLESS;
+    return -1;
+}
+
+
 static int send_to_listener (client_t *client)
 {
     source_t *source = client->shared_data;
@@ -1100,6 +1524,17 @@ static int send_to_listener (client_t *client)
 
     if (source == NULL)
         return -1;
+    if (listener_queue_lockless (source, client))
+    {
+        client->flags |= CLIENT_QUEUE_LOCKLESS;
+        ret = send_listener (source, client);
+        if (client->flags & CLIENT_QUEUE_LOCKLESS)
+        {
+            client->flags &= ~CLIENT_QUEUE_LOCKLESS;
+            if (ret == 0)
+                return 0;
+        }
+    }
     if (thread_rwlock_tryrlock (&source->lock) != 0)
     {
         client->schedule_ms = client->worker->time_ms + 4;
@@ -1178,7 +1613,11 @@ static int send_listener (source_t *source, client_t *client)
     client->schedule_ms = worker->time_ms;
 
     if (source->flags & SOURCE_LISTENERS_SYNC)
+    {
+        if (client->flags & CLIENT_QUEUE_LOCKLESS)
+            return listener_queue_needs_lock (client);
         return listener_waiting_on_source (source, client);
+    }
 
     if (client->connection.error)
         return -1;
@@ -1203,11 +1642,19 @@ static int send_listener (source_t *source, client_t *client)
     }
 
     // do we migrate this listener to the same handler as the source client
-    if (listener_change_worker (client, source))
+    if ((client->flags & CLIENT_QUEUE_LOCKLESS) == 0 && listener_change_worker (client, source))
         return 1;
 
     lag = source->client->queue_pos - client->queue_pos;
 
+    if (listener_paced (source, client, lag))
+        return 0;
+    if (client->flags & CLIENT_KERNEL_PACED)
+    {
+        limiter = source->incoming_rate * 2;    // write until the socket stops us
+        loop = 80;
+    }
+
     /* progessive slowdown if nearing max bandwidth.  */
     if (global.max_rate)
     {
@@ -1244,9 +1691,22 @@ static int send_listener (source_t *source, client_t *client)
             client->schedule_ms += 25;
             break;
         }
+        if ((client->flags & CLIENT_QUEUE_LOCKLESS) && client->check_buffer != source_queue_advance)
+        {
+            listener_queue_needs_lock (client);
+            break;
+        }
         bytes = client->check_buffer (client);
         if (bytes < 0)
         {
+            /* a paced socket holds up to a second of unsent data, so whether
+             * caught up or the socket is full, wait for more to be queued */
+            if ((client->flags & CLIENT_KERNEL_PACED) &&
+                    client->check_buffer == source_queue_advance && client->connection.error == 0)
+            {
+                client_wait_cancel (client);
+                client->schedule_ms = worker->time_ms + 500;
+            }
             break;  /* can't write any more */
         }
 
@@ -1743,6 +2203,13 @@ static void source_apply_mount (source_t *source, mount_proxy *mountinfo)
 
     if (mountinfo && mountinfo->burst_size >= 0)
         source->default_burst_size = (unsigned int)mountinfo->burst_size;
+    source->default_burst_ms = 0;
+    if (mountinfo && mountinfo->burst_duration > 0)
+        source->default_burst_ms = mountinfo->burst_duration;
+
+    source->flags &= ~SOURCE_KERNEL_PACING;
+    if (mountinfo && mountinfo->kernel_pacing)
+        source->flags |= SOURCE_KERNEL_PACING;
 
     if (mountinfo && mountinfo->min_queue_size >= 0)
         source->min_queue_size = mountinfo->min_queue_size;
@@ -1822,6 +2289,8 @@ void source_update_settings (ice_config_t *config, source_t *source, mount_proxy
     DEBUG1 ("queue size to %u", source->queue_size_limit);
     DEBUG1 ("min queue size to %u", source->min_queue_size);
     DEBUG1 ("burst size to %u", source->default_burst_size);
+    if (source->default_burst_ms)
+        DEBUG1 ("burst duration to %ums", source->default_burst_ms);
     DEBUG1 ("source timeout to %u", source->timeout);
 }
 
@@ -2558,31 +3027,26 @@ int source_startup (client_t *client, const char *uri)
 }
 
 
-/* check to see if the source client can be moved to a less busy worker thread.
- * we only move the source client, not the listeners, they will move later
+/* check to see if an idle worker has asked for clients and can take the source
+ * client, its listeners are counted as they will follow it later.
  */
 static int source_change_worker (source_t *source, client_t *client)
 {
     worker_t *this_worker = client->worker, *worker;
     int ret = 0;
 
-    if (this_worker->move_allocations == 0 || worker_count < 2)
+    if (this_worker->steal_to == NULL || worker_count < 2)
         return 0;
     thread_rwlock_rlock (&workers_lock);
-    worker = worker_selected ();
-    if (worker && worker != client->worker)
+    worker = worker_steal_dest (this_worker, source->listeners + 1);
+    if (worker)
     {
-        long diff = this_worker->count - worker->count;
-        if (diff > 50 || (diff > (source->listeners>>1) + 3))
-        {
-            this_worker->move_allocations--;
-            thread_rwlock_unlock (&source->lock);
-            ret = client_change_worker (client, worker);
-            if (ret)
-                DEBUG2 ("moving source from %p to %p", this_worker, worker);
-            else
-                thread_rwlock_wlock (&source->lock);
-        }
+        thread_rwlock_unlock (&source->lock);
+        ret = client_change_worker (client, worker);
+        if (ret)
+            DEBUG2 ("moving source from %p to %p", this_worker, worker);
+        else
+            thread_rwlock_wlock (&source->lock);
     }
     thread_rwlock_unlock (&workers_lock);
     return ret;
@@ -2595,7 +3059,6 @@ static int source_change_worker (source_t *source, client_t *client)
 int listener_change_worker (client_t *client, source_t *source)
 {
     worker_t *this_worker = client->worker, *dest_worker;
-    long diff;
     int ret = 0;
 
     if (this_worker->move_allocations == 0 || worker_count < 2)
@@ -2605,18 +3068,16 @@ int listener_change_worker (client_t *client, source_t *source)
 
     if (this_worker != dest_worker)
     {
-        diff = dest_worker->count - this_worker->count;
-        // do not move listener if source client worker has sufficiently more clients
-        if (diff > 100)
+        // do not move listener if source client worker is sufficiently busier
+        if (dest_worker->load > this_worker->load + WORKER_LOAD_MARGIN)
             dest_worker = NULL;
     }
     else
     {
-        dest_worker = worker_selected ();
-        // do not move if least busy worker is significantly less than ours
-        diff = this_worker->count - dest_worker->count;
-        if (diff < 150)
-            dest_worker = NULL;
+        // only spread listeners away from the source when its worker is saturated
+        dest_worker = NULL;
+        if (this_worker->load > WORKER_LOAD_HIGH)
+            dest_worker = worker_steal_dest (this_worker, 1);
     }
     if (dest_worker)
     {
@@ -21,12 +21,20 @@
 
 #include <stdio.h>
 
+/* stream position of a queued block, used to find burst points */
+typedef struct source_queue_index
+{
+    refbuf_t *block;
+    uint64_t pos;
+    uint64_t samples;   /* from frame indexed blocks before this one */
+} source_queue_index;
+
 typedef struct source_tag
 {
     char *mount;
     unsigned int flags;
     int listener_send_trigger;
-    char wakeup;
+    client_waiters_t waiters;   /* listeners caught up, woken as data is queued */
 
     rwlock_t lock;
 
@@ -62,6 +70,7 @@ typedef struct source_tag
 
     /* per source burst handling for connecting clients */
     unsigned int default_burst_size;
+    unsigned int default_burst_ms;
 
     refbuf_t *min_queue_point;
     unsigned int min_queue_offset;
@@ -83,6 +92,19 @@ typedef struct source_tag
 
     refbuf_t *stream_data;
     refbuf_t *stream_data_tail;
+    uint64_t queue_start;       /* stream position of stream_data, read by lockless listeners */
+
+    /* trimmed blocks, still linked to the queue for lockless listeners */
+    refbuf_t *retired;
+    refbuf_t *retired_end;      /* end of those stamped with retired_epoch */
+    uint64_t retired_epoch;
+
+    /* ring of queued blocks in stream order, oldest at queue_index_head */
+    source_queue_index *queue_index;
+    unsigned int queue_index_head;
+    unsigned int queue_index_count;
+    unsigned int queue_index_size;
+    uint64_t queue_samples;     /* in frame indexed blocks so far */
 
     util_dict *audio_info;
 
@@ -96,6 +118,7 @@ typedef struct source_tag
 #define SOURCE_LISTENERS_SYNC       (1<<5)
 #define SOURCE_TIMEOUT              (1<<6)
 #define SOURCE_RESERVED             (1<<7)
+#define SOURCE_KERNEL_PACING        (1<<8)
 
 #define source_available(x)     (((x)->flags & (SOURCE_RUNNING|SOURCE_ON_DEMAND)) && ((x)->flags & SOURCE_LISTENERS_SYNC) == 0)
 #define source_running(x)       ((x)->flags & SOURCE_RUNNING)
@@ -125,6 +148,8 @@ void source_listeners_wakeup (source_t *source);
 int check_duplicate_logins (const char *mount, avl_tree *tree, client_t *client, auth_t *auth);
 
 #define SOURCE_BLOCK_SYNC           01
+#define SOURCE_BLOCK_CHUNKED        02      /* chunk framing held after the data */
+#define SOURCE_BLOCK_CHUNKING       04
 #define SOURCE_QUEUE_BLOCK          REFBUF_SHARED
 
 #endif
@@ -1139,7 +1139,8 @@ static void stats_client_release (client_t *client)
 struct _client_functions stats_client_send_ops =
 {
     stats_listeners_send,
-    stats_client_release
+    stats_client_release,
+    CLIENT_OPS_STATS
 };
 
 void stats_add_listener (client_t *client, int mask)
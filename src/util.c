@@ -39,6 +39,11 @@
 #include <fnmatch.h>
 #endif
 
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#include <dirent.h>
+#endif
+
 #include "net/sock.h"
 #include "thread/thread.h"
 
@@ -1245,3 +1250,136 @@ int util_expand_pattern (const char *mount, const char *pattern, char *buf, unsi
    return 0;
 }
 
+
+
+/* walk a cpu list like "0-3,8,10-11", calling back for each cpu until
+ * a non-zero return which is passed back. -1 if the list is exhausted
+ */
+static int cpu_list_walk (const char *cpus, int (*callback)(int cpu, void *arg), void *arg)
+{
+    const char *p = cpus;
+
+    while (p && *p)
+    {
+        char *end;
+        long first = strtol (p, &end, 10), last = first;
+
+        if (end == p || first < 0)
+            break;
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtol (p, &end, 10);
+            if (end == p || last < first)
+                break;
+        }
+        for (; first <= last; first++)
+        {
+            int ret = callback ((int)first, arg);
+            if (ret)
+                return ret;
+        }
+        p = end;
+        while (*p == ',' || *p == ' ')
+            p++;
+    }
+    return -1;
+}
+
+
+static int cpu_list_count (int cpu, void *arg)
+{
+    (*(int*)arg)++;
+    return 0;
+}
+
+
+static int cpu_list_index (int cpu, void *arg)
+{
+    int *index = arg;
+    if ((*index)-- == 0)
+        return cpu + 1;
+    return 0;
+}
+
+
+/* return the cpu at index (wrapping) in the cpu list, or -1 if none */
+int util_cpu_from_list (const char *cpus, int index)
+{
+    int count = 0;
+
+    if (cpus == NULL || index < 0)
+        return -1;
+    cpu_list_walk (cpus, cpu_list_count, &count);
+    if (count == 0)
+        return -1;
+    index %= count;
+    return cpu_list_walk (cpus, cpu_list_index, &index) - 1;
+}
+
+
+#ifdef HAVE_SCHED_SETAFFINITY
+static int cpu_list_set (int cpu, void *arg)
+{
+    if (cpu < CPU_SETSIZE)
+        CPU_SET (cpu, (cpu_set_t*)arg);
+    return 0;
+}
+#endif
+
+
+/* pin the calling thread to the cpu given, or to all in the list if cpu is
+ * negative. returns 0 if placed
+ */
+int util_set_cpu_affinity (const char *cpus, int cpu)
+{
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t set;
+
+    CPU_ZERO (&set);
+    if (cpu >= 0)
+        cpu_list_set (cpu, &set);
+    else if (cpus)
+        cpu_list_walk (cpus, cpu_list_set, &set);
+    if (CPU_COUNT (&set) == 0)
+        return -1;
+    if (sched_setaffinity (0, sizeof (set), &set) < 0)
+    {
+        WARN2 ("unable to set cpu affinity to %s, %s", cpus ? cpus : "", strerror (errno));
+        return -1;
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+
+/* numa node the cpu belongs to, -1 if unknown */
+int util_cpu_node (int cpu)
+{
+    int node = -1;
+#ifdef HAVE_SCHED_SETAFFINITY
+    char path [64];
+    DIR *dir;
+
+    if (cpu < 0)
+        return -1;
+    snprintf (path, sizeof path, "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir (path);
+    if (dir)
+    {
+        struct dirent *entry;
+        while ((entry = readdir (dir)))
+        {
+            if (strncmp (entry->d_name, "node", 4) == 0 && isdigit (entry->d_name[4]))
+            {
+                node = atoi (entry->d_name + 4);
+                break;
+            }
+        }
+        closedir (dir);
+    }
+#endif
+    return node;
+}
@@ -95,6 +95,10 @@ void rate_reduce (struct rate_calc *calc, unsigned int range);
 int get_line(FILE *file, char *buf, size_t siz);
 int util_expand_pattern (const char *mount, const char *pattern, char *buf, unsigned int *len_p);
 
+int util_cpu_from_list (const char *cpus, int index);
+int util_set_cpu_affinity (const char *cpus, int cpu);
+int util_cpu_node (int cpu);
+
 void cached_file_init (cache_file_contents *cache, const char *filename, cachefile_add_func add, cachefile_compare_func compare);
 
 int cached_treenode_free (void*x);